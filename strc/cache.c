@@ -0,0 +1,268 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#define _GNU_SOURCE /* pread, ftruncate, st_mtim */
+#include "cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+#define CACHE_MAGIC      "STRCCAC1"
+#define CACHE_SLOTS      4096           /* initial slots, power of two */
+#define CACHE_MAX_SLOTS  (1u << 22)     /* start over instead of growing past */
+#define FP_SIZE          256            /* bytes hashed before the cached size */
+
+#ifdef __APPLE__
+#  define ST_MTIM(st) ((st)->st_mtimespec)
+#else
+#  define ST_MTIM(st) ((st)->st_mtim)
+#endif
+
+struct cache_header
+{
+        char     magic[8];
+        uint32_t nslots;
+        uint32_t used;
+};
+
+struct cache_slot
+{
+        uint64_t dev;
+        uint64_t ino;
+        int64_t  size;
+        int64_t  mtime_sec;
+        int64_t  mtime_nsec;
+        uint64_t fp;                    /* hash of the bytes before 'size' */
+        uint32_t flags;                 /* metrics held by 'n', 0 for a free slot */
+        int32_t  last;
+        struct counts n;
+};
+
+struct cache
+{
+        int fd;
+        size_t maplen;
+        struct cache_header *hdr;
+        struct cache_slot *slots;
+};
+
+static size_t cache_len(uint32_t nslots)
+{
+        return sizeof(struct cache_header) + (size_t) nslots * sizeof(struct cache_slot);
+}
+
+static int cache_map(struct cache *c, uint32_t nslots, int reset)
+{
+        size_t len = cache_len(nslots);
+
+        if (c->hdr)
+                munmap(c->hdr, c->maplen);
+        c->hdr = NULL;
+
+        if (reset && ftruncate(c->fd, (off_t) len) != 0)
+                return errno;
+
+        void *map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, c->fd, 0);
+        if (map == MAP_FAILED)
+                return errno;
+
+        c->maplen = len;
+        c->hdr = map;
+        c->slots = (struct cache_slot *) (c->hdr + 1);
+
+        if (reset) {
+                memset(map, 0, len);
+                memcpy(c->hdr->magic, CACHE_MAGIC, sizeof(c->hdr->magic));
+                c->hdr->nslots = nslots;
+        }
+
+        return 0;
+}
+
+struct cache *cache_open(const char *path)
+{
+        struct cache *c;
+        struct cache_header hdr;
+        struct stat st;
+        int err;
+
+        c = calloc(1, sizeof(*c));
+        if (!c)
+                return NULL;
+
+        c->fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (c->fd < 0)
+                goto fail;
+
+        /* concurrent runs on the same cache take turns */
+        if (flock(c->fd, LOCK_EX) != 0 || fstat(c->fd, &st) != 0)
+                goto fail;
+
+        /* anything that doesn't look like ours is thrown away */
+        if (pread(c->fd, &hdr, sizeof(hdr), 0) == (ssize_t) sizeof(hdr)
+            && memcmp(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic)) == 0
+            && hdr.nslots >= CACHE_SLOTS && hdr.nslots <= CACHE_MAX_SLOTS
+            && (hdr.nslots & (hdr.nslots - 1)) == 0
+            && hdr.used <= hdr.nslots / 4 * 3
+            && (size_t) st.st_size == cache_len(hdr.nslots))
+                err = cache_map(c, hdr.nslots, 0);
+        else
+                err = cache_map(c, CACHE_SLOTS, 1);
+
+        if (err != 0) {
+                errno = err;
+                goto fail;
+        }
+
+        return c;
+
+fail:
+        err = errno;
+        if (c->fd >= 0)
+                close(c->fd);
+        free(c);
+        errno = err;
+        return NULL;
+}
+
+void cache_close(struct cache *c)
+{
+        if (c->hdr)
+                munmap(c->hdr, c->maplen);
+        close(c->fd);
+        free(c);
+}
+
+/* Return the slot of 'dev' and 'ino', or the free one it would take, or
+ * NULL when a damaged file has neither. */
+static struct cache_slot *cache_find(struct cache *c, uint64_t dev, uint64_t ino)
+{
+        uint32_t mask = c->hdr->nslots - 1;
+        uint64_t h = (dev * 0x9E3779B97F4A7C15ULL) ^ (ino * 0xC2B2AE3D27D4EB4FULL);
+        uint32_t i = (uint32_t) (h ^ (h >> 29)) & mask;
+
+        /* the load factor stays below 3/4, unless 'used' lies */
+        for (uint32_t k = 0; k <= mask; k++) {
+                if (c->slots[i].flags == 0
+                    || (c->slots[i].dev == dev && c->slots[i].ino == ino))
+                        return &c->slots[i];
+                i = (i + 1) & mask;
+        }
+
+        return NULL;
+}
+
+static int cache_grow(struct cache *c)
+{
+        uint32_t nslots = c->hdr->nslots;
+        struct cache_slot *old;
+        int err;
+
+        if (nslots * 2 > CACHE_MAX_SLOTS)
+                return cache_map(c, nslots, 1);
+
+        old = malloc((size_t) nslots * sizeof(*old));
+        if (!old)
+                return ENOMEM;
+        memcpy(old, c->slots, (size_t) nslots * sizeof(*old));
+
+        err = cache_map(c, nslots * 2, 1);
+        if (err == 0) {
+                for (uint32_t i = 0; i < nslots; i++) {
+                        if (old[i].flags == 0)
+                                continue;
+                        *cache_find(c, old[i].dev, old[i].ino) = old[i];
+                        c->hdr->used++;
+                }
+        }
+
+        free(old);
+
+        return err;
+}
+
+uint64_t cache_fingerprint(int fd, off_t size, int *last)
+{
+        unsigned char buf[FP_SIZE];
+        off_t off = size > FP_SIZE ? size - FP_SIZE : 0;
+        uint64_t h = 0xCBF29CE484222325ULL;
+        ssize_t n;
+
+        *last = -1;
+        n = pread(fd, buf, (size_t) (size - off), off);
+        if (n <= 0)
+                return h;
+
+        for (ssize_t i = 0; i < n; i++)
+                h = (h ^ buf[i]) * 0x100000001B3ULL;
+        *last = buf[n - 1];
+
+        return h;
+}
+
+int cache_lookup(struct cache *c, int fd, const struct stat *st, unsigned int flags, struct cache_hit *hit)
+{
+        struct cache_slot *slot = cache_find(c, (uint64_t) st->st_dev, (uint64_t) st->st_ino);
+        int last;
+
+        if (!slot || slot->flags == 0 || (slot->flags & flags) != flags)
+                return CACHE_MISS;
+
+        hit->size = (off_t) slot->size;
+        hit->last = slot->last;
+        hit->n = slot->n;
+
+        if (st->st_size == slot->size
+            && ST_MTIM(st).tv_sec == slot->mtime_sec
+            && ST_MTIM(st).tv_nsec == slot->mtime_nsec)
+                return CACHE_HIT;
+
+        /* appended to, as long as the old tail is still in place;
+         * a shrunk or rewritten file is counted again */
+        if (st->st_size > slot->size
+            && cache_fingerprint(fd, (off_t) slot->size, &last) == slot->fp
+            && last == slot->last)
+                return CACHE_GROWN;
+
+        return CACHE_MISS;
+}
+
+int cache_store(struct cache *c, int fd, const struct stat *st, unsigned int flags, const struct counts *n)
+{
+        struct cache_slot *slot = cache_find(c, (uint64_t) st->st_dev, (uint64_t) st->st_ino);
+
+        /* every slot taken, the file was damaged, start over */
+        if (!slot) {
+                int err = cache_map(c, c->hdr->nslots, 1);
+                if (err != 0)
+                        return err;
+                slot = cache_find(c, (uint64_t) st->st_dev, (uint64_t) st->st_ino);
+        }
+
+        if (slot->flags == 0) {
+                if ((c->hdr->used + 1) * 4 > c->hdr->nslots * 3) {
+                        int err = cache_grow(c);
+                        if (err != 0)
+                                return err;
+                        slot = cache_find(c, (uint64_t) st->st_dev, (uint64_t) st->st_ino);
+                }
+                c->hdr->used++;
+        }
+
+        slot->dev = (uint64_t) st->st_dev;
+        slot->ino = (uint64_t) st->st_ino;
+        slot->size = st->st_size;
+        slot->mtime_sec = ST_MTIM(st).tv_sec;
+        slot->mtime_nsec = ST_MTIM(st).tv_nsec;
+        slot->fp = cache_fingerprint(fd, st->st_size, &slot->last);
+        slot->flags = flags;
+        slot->n = *n;
+
+        return 0;
+}
@@ -0,0 +1,49 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * cache - persistent per-file counts keyed by device and inode
+ *
+ * The cache is a hash table in a memory mapped file. An entry remembers
+ * size, mtime and a fingerprint of the last bytes counted, so a later run
+ * can tell an unchanged file (answer from the entry), a file that only
+ * grew (count the new tail and add) and anything else (count again).
+ * The file is locked for the lifetime of the handle.
+ */
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "counter.h"
+
+/* lookup result */
+#define CACHE_MISS                           0 /* count the whole file */
+#define CACHE_HIT                            1 /* counts are current */
+#define CACHE_GROWN                          2 /* count from 'size' on and add */
+
+struct cache;
+
+struct cache_hit
+{
+        off_t size;                     /* bytes covered by 'n' */
+        int last;                       /* byte at size - 1 */
+        struct counts n;
+};
+
+/* Return NULL on failure with errno set. */
+struct cache *cache_open(const char *path);
+void cache_close(struct cache *c);
+
+/* Look up the open file 'fd' described by 'st' for the metrics in 'flags'. */
+int cache_lookup(struct cache *c, int fd, const struct stat *st, unsigned int flags, struct cache_hit *hit);
+/* Remember counts 'n' of the first st->st_size bytes of 'fd'.
+ * Return 0 on success otherwise an errno value. */
+int cache_store(struct cache *c, int fd, const struct stat *st, unsigned int flags, const struct counts *n);
+
+/* Hash of the bytes just before 'size' of 'fd', the last one in 'last' or
+ * -1. Equal fingerprints tell a file was only appended to since. */
+uint64_t cache_fingerprint(int fd, off_t size, int *last);
+
+#endif /* CACHE_H_ */
@@ -0,0 +1,455 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#include "counter.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <r9k/panic.h>
+
+#include "csv.h"
+#include "lineidx.h"
+#include "ndjson.h"
+#include "delim.h"
+#include "dfa.h"
+#include "distinct.h"
+#include "match.h"
+#include "simd.h"
+#include "topk.h"
+#include "utf8.h"
+#include "util.h"
+
+/* With several kernels each buffer is handed to all of them in slices
+ * small enough to stay in L2, so the input is still read from memory
+ * once however big the mapped window is. */
+#define FEED_SLICE ((size_t) 64 << 10) /* 64kb */
+
+static const struct matcher *patterns;
+static const struct regex *regex;
+static unsigned char record_byte = '\n';
+static const struct delim *record_delim;
+
+void counter_patterns(const struct matcher *m, const struct regex *re)
+{
+        patterns = m;
+        regex = re;
+}
+
+void counter_delimiter(unsigned char byte, const struct delim *d)
+{
+        record_byte = byte;
+        record_delim = d;
+}
+
+void counter_init(struct counter *ctr, unsigned int flags)
+{
+        memset(ctr, 0, sizeof(*ctr));
+        ctr->flags = flags;
+
+        if (flags & CNT_LSTAT) {
+                ctr->ls = calloc(1, sizeof(*ctr->ls));
+                PANIC_IF(!ctr->ls, "ERROR: out of memory\n");
+                ctr->ls->min = UINT64_MAX;
+        }
+
+        if (flags & CNT_MATCH) {
+                ctr->ms = match_state_new(patterns);
+                PANIC_IF(!ctr->ms, "ERROR: out of memory\n");
+        }
+
+        if (flags & CNT_REGEX) {
+                ctr->rs = regex_state_new(regex);
+                PANIC_IF(!ctr->rs, "ERROR: out of memory\n");
+        }
+
+        if (flags & CNT_TOPK) {
+                ctr->ts = topk_state_new();
+                PANIC_IF(!ctr->ts, "ERROR: out of memory\n");
+        }
+
+        if (flags & CNT_DISTINCT) {
+                ctr->ds = distinct_state_new();
+                PANIC_IF(!ctr->ds, "ERROR: out of memory\n");
+        }
+
+        if (flags & CNT_UTF8) {
+                ctr->us = calloc(1, sizeof(*ctr->us));
+                PANIC_IF(!ctr->us, "ERROR: out of memory\n");
+        }
+
+        if ((flags & CNT_LINES) && record_delim) {
+                ctr->dl = delim_state_new(record_delim);
+                PANIC_IF(!ctr->dl, "ERROR: out of memory\n");
+        }
+
+        if (flags & CNT_CSV) {
+                ctr->cs = calloc(1, sizeof(*ctr->cs));
+                PANIC_IF(!ctr->cs, "ERROR: out of memory\n");
+        }
+
+        if (flags & CNT_NDJSON) {
+                ctr->js = calloc(1, sizeof(*ctr->js));
+                PANIC_IF(!ctr->js, "ERROR: out of memory\n");
+        }
+
+        if (flags & CNT_INDEX) {
+                ctr->ix = lineidx_state_new();
+                PANIC_IF(!ctr->ix, "ERROR: out of memory\n");
+        }
+}
+
+void counter_free(struct counter *ctr)
+{
+        free(ctr->ls);
+        ctr->ls = NULL;
+        match_state_free(ctr->ms);
+        ctr->ms = NULL;
+        regex_state_free(ctr->rs);
+        ctr->rs = NULL;
+        topk_state_free(ctr->ts);
+        ctr->ts = NULL;
+        distinct_state_free(ctr->ds);
+        ctr->ds = NULL;
+        free(ctr->us);
+        ctr->us = NULL;
+        delim_state_free(ctr->dl);
+        ctr->dl = NULL;
+        free(ctr->cs);
+        ctr->cs = NULL;
+        free(ctr->js);
+        ctr->js = NULL;
+        lineidx_state_free(ctr->ix);
+        ctr->ix = NULL;
+}
+
+void counter_seed(struct counter *ctr, int prev)
+{
+        ctr->in_word = prev >= 0 && !is_ws(prev);
+        if (ctr->ms)
+                match_reset(ctr->ms);
+        if (ctr->rs)
+                regex_reset(ctr->rs);
+        if (ctr->ts)
+                topk_reset(ctr->ts);
+        if (ctr->ds)
+                distinct_reset(ctr->ds);
+        if (ctr->us)
+                utf8_reset(ctr->us);
+        if (ctr->dl)
+                delim_reset(ctr->dl);
+        if (ctr->cs)
+                csv_reset(ctr->cs);
+        if (ctr->js)
+                ndjson_reset(ctr->js);
+}
+
+static void feed_slice(struct counter *ctr, unsigned int want, const char *buf, size_t len)
+{
+        /* a single metric has a dedicated kernel, anything else goes
+         * through the fused one */
+        if (want == CNT_LINES) {
+                ctr->n.lines += simd_count_byte(buf, len, record_byte);
+        } else if (want == CNT_CHARS) {
+                ctr->n.chars += simd_count_utf8(buf, len);
+        } else if (want) {
+                struct simd_tally t = { 0, 0, 0, ctr->in_word };
+                simd_tally(buf, len, &t);
+                /* the fused kernel only knows newlines */
+                if (want & CNT_LINES)
+                        ctr->n.lines += record_byte == '\n' ? t.lines : simd_count_byte(buf, len, record_byte);
+                ctr->n.chars += t.chars;
+                ctr->n.words += t.words;
+                ctr->in_word = t.in_word;
+        }
+}
+
+void counter_feed(struct counter *ctr, const char *buf, size_t len)
+{
+        unsigned int want = ctr->flags & (CNT_CHARS | CNT_LINES | CNT_WORDS);
+
+        ctr->n.bytes += len;
+
+        if (!ctr->ls && !ctr->ms && !ctr->rs && !ctr->ts && !ctr->ds && !ctr->us && !ctr->dl && !ctr->cs && !ctr->js && !ctr->ix) {
+                feed_slice(ctr, want, buf, len);
+                return;
+        }
+
+        /* newlines come from the line length kernel, records from the
+         * delimiter search */
+        if (ctr->ls || ctr->dl)
+                want &= ~CNT_LINES;
+
+        for (size_t off = 0; off < len; off += FEED_SLICE) {
+                size_t n = len - off < FEED_SLICE ? len - off : FEED_SLICE;
+                uint64_t lines = ctr->n.lines;
+
+                if (ctr->ls) {
+                        uint64_t seen = ctr->ls->lines;
+                        simd_lines(buf + off, n, ctr->ls);
+                        ctr->n.lines += ctr->ls->lines - seen;
+                }
+
+                if (ctr->ms)
+                        match_feed(ctr->ms, buf + off, n);
+
+                if (ctr->rs)
+                        regex_feed(ctr->rs, buf + off, n);
+
+                if (ctr->ts)
+                        topk_feed(ctr->ts, buf + off, n);
+
+                if (ctr->ds)
+                        distinct_feed(ctr->ds, buf + off, n);
+
+                if (ctr->us)
+                        utf8_feed(ctr->us, buf + off, n);
+
+                if (ctr->dl) {
+                        uint64_t seen = ctr->dl->count;
+                        delim_feed(ctr->dl, buf + off, n);
+                        ctr->n.lines += ctr->dl->count - seen;
+                }
+
+                if (ctr->cs)
+                        csv_feed(ctr->cs, buf + off, n);
+
+                if (ctr->js)
+                        ndjson_feed(ctr->js, buf + off, n);
+
+                feed_slice(ctr, want, buf + off, n);
+
+                /* samples go by the newlines just counted */
+                if (ctr->ix)
+                        lineidx_feed(ctr->ix, buf + off, n, ctr->n.lines - lines);
+        }
+}
+
+void counter_zeros(struct counter *ctr, uint64_t len)
+{
+        static const char zeros[FEED_SLICE];
+
+        /* the kernels with a state see every byte */
+        if (ctr->ls || ctr->ms || ctr->rs || ctr->ts || ctr->ds || ctr->us || ctr->dl || ctr->cs
+            || ctr->js || ctr->ix) {
+                for (; len > 0; len -= len < FEED_SLICE ? len : FEED_SLICE)
+                        counter_feed(ctr, zeros, len < FEED_SLICE ? (size_t) len : FEED_SLICE);
+                return;
+        }
+
+        if (len == 0)
+                return;
+
+        /* a NUL is a character and part of a word */
+        ctr->n.bytes += len;
+        ctr->n.chars += ctr->flags & CNT_CHARS ? len : 0;
+        ctr->n.lines += ctr->flags & CNT_LINES && record_byte == '\0' ? len : 0;
+        ctr->n.words += ctr->flags & CNT_WORDS && !ctr->in_word;
+        ctr->in_word = 1;
+}
+
+int counter_bytes_only(const struct counter *ctr)
+{
+        return ctr->flags == CNT_BYTES;
+}
+
+int counter_splittable(const struct counter *ctr)
+{
+        return !ctr->cs && (!ctr->dl || delim_splittable(record_delim));
+}
+
+void counter_total(struct counter *ctr)
+{
+        ctr->total = 1;
+}
+
+void counter_merge(struct counter *dst, const struct counter *src)
+{
+        dst->n.bytes += src->n.bytes;
+        dst->n.chars += src->n.chars;
+        dst->n.lines += src->n.lines;
+        dst->n.words += src->n.words;
+
+        if (dst->ls && src->ls) {
+                dst->ls->lines += src->ls->lines;
+                dst->ls->total += src->ls->total;
+                if (src->ls->min < dst->ls->min)
+                        dst->ls->min = src->ls->min;
+                if (src->ls->max > dst->ls->max)
+                        dst->ls->max = src->ls->max;
+                for (int i = 0; i < SIMD_LEN_BUCKETS; i++)
+                        dst->ls->hist[i] += src->ls->hist[i];
+                dst->ls->cur = src->ls->cur;
+        }
+
+        if (dst->ms && src->ms)
+                match_merge(dst->ms, src->ms);
+
+        if (dst->rs && src->rs)
+                regex_merge(dst->rs, src->rs);
+
+        if (dst->ts && src->ts)
+                topk_merge(dst->ts, src->ts);
+
+        if (dst->ds && src->ds)
+                distinct_merge(dst->ds, src->ds);
+
+        if (dst->us && src->us)
+                utf8_merge(dst->us, src->us);
+
+        if (dst->dl && src->dl)
+                dst->n.lines += delim_merge(dst->dl, src->dl);
+
+        if (dst->cs && src->cs)
+                csv_merge(dst->cs, src->cs);
+
+        if (dst->js && src->js)
+                ndjson_merge(dst->js, src->js);
+
+        if (dst->ix && src->ix)
+                lineidx_merge(dst->ix, src->ix);
+}
+
+void counter_finish(struct counter *ctr)
+{
+        if (ctr->ls && ctr->ls->cur) {
+                simd_lines_add(ctr->ls, ctr->ls->cur);
+                ctr->ls->cur = 0;
+        }
+
+        if (ctr->rs)
+                regex_finish(ctr->rs);
+
+        if (ctr->ts)
+                topk_finish(ctr->ts);
+
+        if (ctr->ds)
+                distinct_finish(ctr->ds);
+
+        if (ctr->us)
+                utf8_finish(ctr->us);
+
+        if (ctr->dl)
+                delim_finish(ctr->dl);
+
+        if (ctr->cs)
+                csv_finish(ctr->cs);
+
+        if (ctr->js)
+                ndjson_finish(ctr->js);
+}
+
+uint64_t counter_primary(const struct counter *ctr)
+{
+        return ctr->flags & CNT_MATCH ? ctr->ms->lines
+               : ctr->flags & CNT_REGEX ? ctr->rs->lines
+               : ctr->flags & CNT_CSV ? ctr->cs->records
+               : ctr->flags & CNT_NDJSON ? ctr->js->records - ctr->js->malformed
+               : ctr->flags & CNT_LINES ? ctr->n.lines
+               : ctr->flags & CNT_WORDS ? ctr->n.words
+               : ctr->flags & CNT_CHARS ? ctr->n.chars
+               : ctr->n.bytes;
+}
+
+/* length summary, then one row per non-empty log2 bucket */
+static void print_lines(const struct simd_lines *ls)
+{
+        if (ls->lines == 0) {
+                printf("        min 0 max 0 mean 0.00\n");
+                return;
+        }
+
+        printf("        min %" PRIu64 " max %" PRIu64 " mean %.2f\n",
+               ls->min, ls->max, (double) ls->total / (double) ls->lines);
+
+        for (int i = 0; i < SIMD_LEN_BUCKETS; i++) {
+                uint64_t lo = i ? (uint64_t) 1 << (i - 1) : 0;
+                uint64_t hi = i ? lo + (lo - 1) : 0;
+
+                if (ls->hist[i])
+                        printf("        %8" PRIu64 " - %-8" PRIu64 " %8" PRIu64 " %6.2f%%\n",
+                               lo, hi, ls->hist[i], 100.0 * (double) ls->hist[i] / (double) ls->lines);
+        }
+}
+
+static void print_ndjson(const struct ndjson_state *js)
+{
+        for (size_t i = 0; i < js->nbad; i++)
+                printf("        malformed record at line %" PRIu64 ", %s\n", js->bad[i].line,
+                       ndjson_error(js->bad[i].why));
+
+        if (js->malformed > js->nbad)
+                printf("        ... %" PRIu64 " more malformed records\n", js->malformed - js->nbad);
+}
+
+void counter_print(const struct counter *ctr, const char *name)
+{
+        const char *sep = "";
+
+        /* a lone number without a name is printed bare, like before */
+        if (!name && __builtin_popcount(ctr->flags) == 1 && (ctr->flags & CNT_BASIC)) {
+                printf("%" PRIu64 "\n", counter_primary(ctr));
+                return;
+        }
+
+        if (ctr->flags & CNT_MATCH) {
+                printf("%8" PRIu64 " %8" PRIu64, ctr->ms->lines, ctr->ms->hits);
+                sep = " ";
+        }
+
+        if (ctr->flags & CNT_REGEX) {
+                printf("%s%8" PRIu64, sep, ctr->rs->lines);
+                sep = " ";
+        }
+
+        if (ctr->flags & CNT_CSV) {
+                printf("%s%8" PRIu64 " %8" PRIu64 " %8" PRIu64, sep,
+                       ctr->cs->records, ctr->cs->fields, ctr->cs->malformed);
+                sep = " ";
+        }
+
+        if (ctr->flags & CNT_NDJSON) {
+                printf("%s%8" PRIu64 " %8" PRIu64, sep,
+                       ctr->js->records - ctr->js->malformed, ctr->js->malformed);
+                sep = " ";
+        }
+
+        if (ctr->flags & CNT_LINES) {
+                printf("%s%8" PRIu64, sep, ctr->n.lines);
+                sep = " ";
+        }
+
+        if (ctr->flags & CNT_WORDS) {
+                printf("%s%8" PRIu64, sep, ctr->n.words);
+                sep = " ";
+        }
+
+        if (ctr->flags & CNT_CHARS) {
+                printf("%s%8" PRIu64, sep, ctr->n.chars);
+                sep = " ";
+        }
+
+        if (ctr->flags & CNT_BYTES)
+                printf("%s%8" PRIu64, sep, ctr->n.bytes);
+
+        if (name)
+                printf(" %s", name);
+
+        printf("\n");
+
+        if (ctr->ls)
+                print_lines(ctr->ls);
+
+        if (ctr->us && ctr->us->bad && ctr->total)
+                printf("        invalid UTF-8\n");
+        else if (ctr->us && ctr->us->bad)
+                printf("        invalid UTF-8 at byte %" PRIu64 ", line %" PRIu64 "\n",
+                       ctr->us->bad_off, ctr->us->bad_line);
+        else if (ctr->us)
+                printf("        valid UTF-8\n");
+
+        if (ctr->js && !ctr->total)
+                print_ndjson(ctr->js);
+}
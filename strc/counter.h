@@ -0,0 +1,119 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * counter - accumulate every requested metric over a stream of buffers
+ *
+ * All metrics are computed in one pass over each buffer handed to
+ * counter_feed(), so asking for bytes, lines, characters and words costs a
+ * single read of the input.
+ */
+#ifndef COUNTER_H_
+#define COUNTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* metric flags */
+#define CNT_BYTES                            (1 << 0) /* -c */
+#define CNT_CHARS                            (1 << 1) /* -m */
+#define CNT_LINES                            (1 << 2) /* -l */
+#define CNT_WORDS                            (1 << 3) /* -w */
+#define CNT_LSTAT                            (1 << 4) /* -L, line lengths */
+#define CNT_MATCH                            (1 << 5) /* -p, literals */
+#define CNT_REGEX                            (1 << 6) /* -e, regex */
+#define CNT_TOPK                             (1 << 7) /* --top, key frequencies */
+#define CNT_DISTINCT                         (1 << 8) /* --distinct, key cardinality */
+#define CNT_UTF8                             (1 << 9) /* -u, UTF-8 validation */
+#define CNT_CSV                              (1 << 10) /* --csv, records and fields */
+#define CNT_NDJSON                           (1 << 11) /* --ndjson, record check */
+#define CNT_INDEX                            (1 << 12) /* --index, line offset samples */
+
+/* The metrics above these are line oriented, they need ranges cut at
+ * line boundaries and are not kept by the cache. */
+#define CNT_BASIC                            (CNT_BYTES | CNT_CHARS | CNT_LINES | CNT_WORDS)
+
+struct simd_lines;
+struct delim;
+struct delim_state;
+struct matcher;
+struct match_state;
+struct regex;
+struct regex_state;
+struct topk_state;
+struct distinct_state;
+struct utf8_state;
+struct csv_state;
+struct ndjson_state;
+struct lineidx_state;
+
+struct counts
+{
+        uint64_t bytes;
+        uint64_t chars;
+        uint64_t lines;
+        uint64_t words;
+};
+
+struct counter
+{
+        unsigned int flags;
+        int in_word;                    /* last byte fed was part of a word */
+        int total;                      /* sums whole streams, see counter_total() */
+        struct counts n;
+        struct simd_lines *ls;          /* with CNT_LSTAT */
+        struct match_state *ms;         /* with CNT_MATCH */
+        struct regex_state *rs;         /* with CNT_REGEX */
+        struct topk_state *ts;          /* with CNT_TOPK */
+        struct distinct_state *ds;      /* with CNT_DISTINCT */
+        struct utf8_state *us;          /* with CNT_UTF8 */
+        struct delim_state *dl;         /* with CNT_LINES and a multi-byte delimiter */
+        struct csv_state *cs;           /* with CNT_CSV */
+        struct ndjson_state *js;        /* with CNT_NDJSON */
+        struct lineidx_state *ix;       /* with CNT_INDEX */
+};
+
+/* Literals and regex searched by CNT_MATCH and CNT_REGEX counters
+ * initialized afterwards. */
+void counter_patterns(const struct matcher *m, const struct regex *re);
+/* Make CNT_LINES count records ending in 'byte', or in 'd' when it is not
+ * NULL, for counters initialized afterwards. Newline by default. */
+void counter_delimiter(unsigned char byte, const struct delim *d);
+
+void counter_init(struct counter *ctr, unsigned int flags);
+void counter_free(struct counter *ctr);
+/* Prepare 'ctr' to count a range that directly follows byte 'prev' of the
+ * same stream (-1 for the stream start), so merging the counters of
+ * consecutive ranges gives the totals of the whole stream. */
+void counter_seed(struct counter *ctr, int prev);
+void counter_feed(struct counter *ctr, const char *buf, size_t len);
+/* Count 'len' zero bytes, a hole of a sparse file. Plain counts are
+ * worked out without touching memory. */
+void counter_zeros(struct counter *ctr, uint64_t len);
+/* Return non-zero when only the byte count is requested, which needs no
+ * look at the data. */
+int counter_bytes_only(const struct counter *ctr);
+/* Return non-zero when ranges of one stream can be counted apart and
+ * merged. */
+int counter_splittable(const struct counter *ctr);
+/* Make 'ctr' the sum of whole streams merged into it. Line numbers and
+ * offsets of one stream mean nothing there and are not printed. */
+void counter_total(struct counter *ctr);
+/* Add the totals of 'src' to 'dst'. Either 'src' continues the stream of
+ * 'dst' from a line boundary, or 'dst' is finished. */
+void counter_merge(struct counter *dst, const struct counter *src);
+/* The stream has ended, account its unterminated last line. */
+void counter_finish(struct counter *ctr);
+
+/* The first requested metric in column order. */
+uint64_t counter_primary(const struct counter *ctr);
+
+/* Print the requested metrics in column order (lines and occurrences of
+ * literals, lines matching the regex, CSV records, fields and malformed
+ * records, well-formed and malformed JSON records, then wc's lines,
+ * words, characters and bytes), followed by 'name' when it is not NULL.
+ * A single metric without a name is printed as a bare number. Line
+ * length statistics and the UTF-8 verdict follow on their own lines. */
+void counter_print(const struct counter *ctr, const char *name);
+
+#endif /* COUNTER_H_ */
@@ -0,0 +1,154 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#include "csv.h"
+
+#include "simd.h"
+
+/* bitmaps of one slice live on the stack, 4 words per 64 bytes */
+#define CSV_SLICE ((size_t) 16 << 10) /* 16kb */
+#define CSV_WORDS (CSV_SLICE / 64)
+
+enum { B_QUOTE, B_SEP, B_NL, B_CR };
+
+static unsigned char csv_bytes[4] = { '"', ',', '\n', '\r' };
+
+void csv_setup(unsigned char sep)
+{
+        csv_bytes[B_SEP] = sep;
+}
+
+void csv_reset(struct csv_state *cs)
+{
+        cs->start = cs->pos;
+        cs->seps = 0;
+        cs->bad = 0;
+        cs->in_quote = 0;
+        cs->in_field = 0;
+        cs->after_cr = 0;
+        cs->closed = 0;
+}
+
+/* bit i of the result is the XOR of bits 0..i of 'x' */
+static inline uint64_t prefix_xor(uint64_t x)
+{
+        x ^= x << 1;
+        x ^= x << 2;
+        x ^= x << 4;
+        x ^= x << 8;
+        x ^= x << 16;
+        x ^= x << 32;
+
+        return x;
+}
+
+/* The record open since cs->start ends before stream offset 'end'. */
+static void end_record(struct csv_state *cs, uint64_t end, int cr_before)
+{
+        uint64_t len = end - cs->start;
+
+        if (len > 1 || (len == 1 && !cr_before)) {
+                uint64_t fields = cs->seps + 1;
+
+                cs->records++;
+                cs->fields += fields;
+                if (!cs->expect)
+                        cs->expect = fields;
+                else if (fields != cs->expect)
+                        cs->bad = 1;
+                cs->malformed += cs->bad != 0;
+        }
+
+        cs->start = end + 1;
+        cs->seps = 0;
+        cs->bad = 0;
+}
+
+/* One word of bitmaps for the 'nbits' bytes at stream offset 'base'. */
+static void csv_block(struct csv_state *cs, const uint64_t *w, uint64_t base, unsigned nbits)
+{
+        uint64_t valid = nbits == 64 ? ~0ULL : (1ULL << nbits) - 1;
+        uint64_t quote = w[B_QUOTE];
+        uint64_t cr = w[B_CR];
+        uint64_t inq = prefix_xor(quote) ^ (cs->in_quote ? ~0ULL : 0);
+        uint64_t sep = w[B_SEP] & ~inq;
+        uint64_t nl = w[B_NL] & ~inq;
+        uint64_t opens = quote & inq;
+        uint64_t closes = quote & ~inq;
+
+        /* a quote opens a field or escapes one, and closes before a
+         * separator, line end or escaped quote */
+        uint64_t marks = w[B_SEP] | w[B_NL] | quote;
+        uint64_t after_mark = marks << 1 | (uint64_t) !cs->in_field;
+        uint64_t before_mark = (marks | cr) >> 1 | ~(valid >> 1);
+        uint64_t bad = (opens & ~after_mark) | (closes & ~before_mark);
+
+        /* a quote closed at the end of the last word */
+        if (cs->closed && !((marks | cr) & 1))
+                cs->bad = 1;
+
+        uint64_t from = ~0ULL;
+        for (uint64_t ends = nl; ends; ends &= ends - 1) {
+                unsigned p = (unsigned) __builtin_ctzll(ends);
+                uint64_t below = from & ((1ULL << p) - 1);
+                int cr_before = p ? (int) (cr >> (p - 1) & 1) : cs->after_cr;
+
+                cs->seps += (uint64_t) __builtin_popcountll(sep & below);
+                cs->bad |= (bad & below) != 0;
+                end_record(cs, base + p, cr_before);
+                from = p == 63 ? 0 : ~0ULL << (p + 1);
+        }
+
+        cs->seps += (uint64_t) __builtin_popcountll(sep & from);
+        cs->bad |= (bad & from) != 0;
+
+        unsigned last = nbits - 1;
+        cs->in_quote = (int) (inq >> last & 1);
+        cs->in_field = !(marks >> last & 1);
+        cs->after_cr = (int) (cr >> last & 1);
+        cs->closed = (int) (closes >> last & 1);
+}
+
+void csv_feed(struct csv_state *cs, const char *buf, size_t n)
+{
+        uint64_t bits[4 * CSV_WORDS];
+
+        for (size_t off = 0; off < n; off += CSV_SLICE) {
+                size_t len = n - off < CSV_SLICE ? n - off : CSV_SLICE;
+
+                simd_find_bytes4(buf + off, len, csv_bytes, bits);
+
+                for (size_t i = 0; i < len; i += 64) {
+                        unsigned nbits = len - i < 64 ? (unsigned) (len - i) : 64;
+                        csv_block(cs, bits + 4 * (i / 64), cs->pos + i, nbits);
+                }
+
+                cs->pos += len;
+        }
+}
+
+void csv_merge(struct csv_state *dst, const struct csv_state *src)
+{
+        uint64_t records = dst->records + src->records;
+        uint64_t fields = dst->fields + src->fields;
+        uint64_t malformed = dst->malformed + src->malformed;
+        uint64_t expect = dst->expect ? dst->expect : src->expect;
+
+        *dst = *src;
+        dst->records = records;
+        dst->fields = fields;
+        dst->malformed = malformed;
+        dst->expect = expect;
+}
+
+void csv_finish(struct csv_state *cs)
+{
+        if (cs->in_quote)
+                cs->bad = 1;
+
+        if (cs->pos > cs->start)
+                end_record(cs, cs->pos, cs->after_cr);
+
+        csv_reset(cs);
+}
@@ -0,0 +1,49 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * csv - count records and fields of RFC 4180 style CSV
+ *
+ * Quotes, separators, newlines and carriage returns of 64 bytes at a time
+ * are turned into bitmaps by a vector kernel. A prefix XOR over the quote
+ * bits masks the quoted regions, escaped "" quotes cancel out on their
+ * own, so only newlines and separators outside quotes are left to count.
+ * A record is malformed when a quote opens or closes in the middle of a
+ * field, a quote is never closed, or its field count differs from that of
+ * the first record. Blank lines are skipped. The quote state at a byte
+ * depends on everything before it, so a stream can't be split in ranges.
+ */
+#ifndef CSV_H_
+#define CSV_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct csv_state
+{
+        uint64_t records;
+        uint64_t fields;
+        uint64_t malformed;
+        uint64_t expect;                /* fields of the first record, 0 before it */
+        uint64_t pos;                   /* stream offset of the next byte fed */
+        uint64_t start;                 /* offset of the open record */
+        uint64_t seps;                  /* its separators so far */
+        int bad;                        /* ... and whether it is malformed */
+        int in_quote;                   /* the last byte fed was quoted */
+        int in_field;                   /* ... was not a separator, newline or quote */
+        int after_cr;                   /* ... was a carriage return */
+        int closed;                     /* ... closed a quote */
+};
+
+/* Fields are separated by 'sep', ',' unless set before counting. */
+void csv_setup(unsigned char sep);
+
+void csv_reset(struct csv_state *cs);
+void csv_feed(struct csv_state *cs, const char *buf, size_t n);
+/* 'src' continues the stream of 'dst', add its counts and take over its
+ * open record. */
+void csv_merge(struct csv_state *dst, const struct csv_state *src);
+/* The stream has ended, close its last record. */
+void csv_finish(struct csv_state *cs);
+
+#endif /* CSV_H_ */
@@ -0,0 +1,277 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#include "delim.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simd.h"
+
+/* candidate bitmaps of one slice live on the stack */
+#define DELIM_SLICE ((size_t) 64 << 10) /* 64kb */
+#define DELIM_WORDS (DELIM_SLICE / 64)
+
+struct delim
+{
+        size_t len;
+        int border_free;                /* no proper prefix is also a suffix */
+        char s[];
+};
+
+static int hex_digit(char c)
+{
+        if (c >= '0' && c <= '9')
+                return c - '0';
+        if (c >= 'a' && c <= 'f')
+                return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+                return c - 'A' + 10;
+        return -1;
+}
+
+char *delim_parse(const char *spec, size_t *len)
+{
+        char *out = malloc(strlen(spec) + 1);
+        size_t n = 0;
+
+        if (!out)
+                return NULL;
+
+        for (const char *p = spec; *p; p++) {
+                if (*p != '\\') {
+                        out[n++] = *p;
+                        continue;
+                }
+
+                switch (*++p) {
+                case 'n':  out[n++] = '\n'; break;
+                case 'r':  out[n++] = '\r'; break;
+                case 't':  out[n++] = '\t'; break;
+                case '0':  out[n++] = '\0'; break;
+                case '\\': out[n++] = '\\'; break;
+                case 'x':
+                        if (hex_digit(p[1]) >= 0 && hex_digit(p[2]) >= 0) {
+                                out[n++] = (char) (hex_digit(p[1]) * 16 + hex_digit(p[2]));
+                                p += 2;
+                                break;
+                        }
+                        /* fall through */
+                default:
+                        free(out);
+                        errno = EINVAL;
+                        return NULL;
+                }
+        }
+
+        if (n == 0) {
+                free(out);
+                errno = EINVAL;
+                return NULL;
+        }
+
+        *len = n;
+
+        return out;
+}
+
+struct delim *delim_compile(const char *s, size_t len)
+{
+        struct delim *d = malloc(sizeof(*d) + len);
+
+        if (!d)
+                return NULL;
+
+        d->len = len;
+        memcpy(d->s, s, len);
+
+        d->border_free = 1;
+        for (size_t k = 1; k < len; k++) {
+                if (memcmp(s, s + len - k, k) == 0)
+                        d->border_free = 0;
+        }
+
+        return d;
+}
+
+void delim_free(struct delim *d)
+{
+        free(d);
+}
+
+int delim_splittable(const struct delim *d)
+{
+        return d->border_free;
+}
+
+struct delim_state *delim_state_new(const struct delim *d)
+{
+        struct delim_state *ds = calloc(1, sizeof(*ds));
+
+        if (!ds)
+                return NULL;
+
+        ds->head = malloc(d->len - 1);
+        ds->tail = malloc(2 * (d->len - 1));
+        if (!ds->head || !ds->tail) {
+                delim_state_free(ds);
+                return NULL;
+        }
+
+        ds->d = d;
+
+        return ds;
+}
+
+void delim_state_free(struct delim_state *ds)
+{
+        if (ds) {
+                free(ds->head);
+                free(ds->tail);
+                free(ds);
+        }
+}
+
+void delim_reset(struct delim_state *ds)
+{
+        ds->ntail = 0;
+        ds->next = ds->pos;
+        ds->done = 0;
+}
+
+static void occurrence(struct delim_state *ds, uint64_t at)
+{
+        if (at < ds->next)
+                return;
+
+        ds->count++;
+        ds->next = at + ds->d->len;
+}
+
+/* Occurrences starting in the tail and ending in buf[0, n). The tail is
+ * followed by the byte at stream offset 'at', the first of 'buf'. */
+static void search_joint(struct delim_state *ds, uint64_t at, const char *buf, size_t n)
+{
+        const struct delim *d = ds->d;
+        size_t head = n < d->len - 1 ? n : d->len - 1;
+        char *joined = ds->tail;
+
+        memcpy(joined + ds->ntail, buf, head);
+
+        for (size_t s = 0; s < ds->ntail; s++) {
+                if (s + d->len > ds->ntail + head)
+                        break;
+                if (memcmp(joined + s, d->s, d->len) == 0)
+                        occurrence(ds, at - ds->ntail + s);
+        }
+}
+
+/* keep the last len - 1 bytes, 'buf' follows the tail */
+static void save_tail(struct delim_state *ds, const char *buf, size_t n)
+{
+        size_t keep = ds->d->len - 1;
+
+        if (n >= keep) {
+                memcpy(ds->tail, buf + n - keep, keep);
+                ds->ntail = keep;
+                return;
+        }
+
+        if (ds->ntail + n > keep) {
+                size_t drop = ds->ntail + n - keep;
+                memmove(ds->tail, ds->tail + drop, ds->ntail - drop);
+                ds->ntail -= drop;
+        }
+
+        memcpy(ds->tail + ds->ntail, buf, n);
+        ds->ntail += n;
+}
+
+static void save_head(struct delim_state *ds, const char *buf, size_t n)
+{
+        size_t room = ds->d->len - 1 - ds->nhead;
+
+        if (n > room)
+                n = room;
+
+        memcpy(ds->head + ds->nhead, buf, n);
+        ds->nhead += n;
+}
+
+static void search_slice(struct delim_state *ds, const char *buf, size_t n)
+{
+        const struct delim *d = ds->d;
+        uint64_t cand[DELIM_WORDS];
+
+        if (ds->nhead < d->len - 1)
+                save_head(ds, buf, n);
+
+        if (ds->ntail)
+                search_joint(ds, ds->pos, buf, n);
+
+        if (n >= d->len) {
+                simd_find_pair(buf, n, d->len - 1, (unsigned char) d->s[0],
+                               (unsigned char) d->s[d->len - 1], cand);
+
+                for (size_t w = 0; w < (n - d->len + 64) / 64; w++) {
+                        for (uint64_t bits = cand[w]; bits; bits &= bits - 1) {
+                                size_t at = w * 64 + (size_t) __builtin_ctzll(bits);
+
+                                /* two bytes are fully checked by the filter */
+                                if (ds->pos + at >= ds->next
+                                    && (d->len == 2 || memcmp(buf + at, d->s, d->len) == 0))
+                                        occurrence(ds, ds->pos + at);
+                        }
+                }
+        }
+
+        save_tail(ds, buf, n);
+        ds->pos += n;
+}
+
+void delim_feed(struct delim_state *ds, const char *buf, size_t n)
+{
+        for (size_t off = 0; off < n; off += DELIM_SLICE)
+                search_slice(ds, buf + off, n - off < DELIM_SLICE ? n - off : DELIM_SLICE);
+}
+
+uint64_t delim_merge(struct delim_state *dst, const struct delim_state *src)
+{
+        uint64_t before = dst->count;
+        uint64_t next = dst->pos + src->next;
+
+        if (dst->ntail && !dst->done)
+                search_joint(dst, dst->pos, src->head, src->nhead);
+
+        uint64_t joint = dst->count - before;
+
+        dst->count += src->count;
+        if (next > dst->next)
+                dst->next = next;
+
+        if (dst->nhead < dst->d->len - 1)
+                save_head(dst, src->head, src->nhead);
+
+        /* src->head holds all of a range shorter than the tail */
+        if (src->done) {
+                dst->ntail = 0;
+        } else if (src->pos > src->nhead) {
+                memcpy(dst->tail, src->tail, src->ntail);
+                dst->ntail = src->ntail;
+        } else {
+                save_tail(dst, src->head, src->nhead);
+        }
+
+        dst->done = src->done;
+        dst->pos += src->pos;
+
+        return joint;
+}
+
+void delim_finish(struct delim_state *ds)
+{
+        ds->ntail = 0;
+        ds->done = 1;
+}
@@ -0,0 +1,54 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * delim - count records ending in a multi-byte delimiter
+ *
+ * Candidates come from the vectorized first and last byte filter also used
+ * for literals, then memcmp(). Occurrences don't overlap, the leftmost one
+ * wins. A delimiter that cannot overlap itself, like "\r\n", is counted
+ * exactly over ranges cut anywhere: each range keeps its first and last
+ * bytes, and merging looks for the occurrences across the cut.
+ */
+#ifndef DELIM_H_
+#define DELIM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct delim;
+
+struct delim_state
+{
+        const struct delim *d;
+        uint64_t count;
+        uint64_t pos;                   /* stream offset of the next byte fed */
+        uint64_t next;                  /* where the next occurrence may start */
+        size_t nhead;
+        size_t ntail;
+        char *head;                     /* first len - 1 bytes fed */
+        char *tail;                     /* last len - 1 bytes fed, room to join a head */
+        int done;                       /* finished, nothing joins the tail */
+};
+
+/* Parse 'spec' with the escapes \n \r \t \0 \\ and \xHH into a delimiter
+ * of 'len' bytes. Return NULL on failure with errno set. */
+char *delim_parse(const char *spec, size_t *len);
+
+/* Compile a delimiter of at least two bytes, NULL without memory. */
+struct delim *delim_compile(const char *s, size_t len);
+void delim_free(struct delim *d);
+/* Return non-zero when ranges of a stream can be counted apart. */
+int delim_splittable(const struct delim *d);
+
+struct delim_state *delim_state_new(const struct delim *d);
+void delim_state_free(struct delim_state *ds);
+void delim_reset(struct delim_state *ds);
+void delim_feed(struct delim_state *ds, const char *buf, size_t n);
+/* 'src' continues the stream of 'dst'. Return the occurrences across the
+ * cut, already added to dst->count. */
+uint64_t delim_merge(struct delim_state *dst, const struct delim_state *src);
+/* The stream has ended, nothing continues it. */
+void delim_finish(struct delim_state *ds);
+
+#endif /* DELIM_H_ */
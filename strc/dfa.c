@@ -0,0 +1,1079 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#include "dfa.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <r9k/panic.h>
+
+#include "simd.h"
+
+#define PROG_MAX   (1 << 16)            /* NFA instructions */
+#define DEPTH_MAX  256                  /* nested groups and repetitions */
+#define REP_MAX    1000                 /* largest {m,n} bound */
+#define PREFIX_MAX 64
+#define PREFIX_WINDOW 4096              /* bytes searched per candidate bitmap */
+
+/* Bounds of the per-thread DFA cache, about 5mb. Hitting either flushes
+ * every state and the input goes on from a fresh cache. */
+#define DFA_STATES 1024
+#define DFA_SETMEM (1 << 20)            /* NFA state ids held by all states */
+
+enum
+{
+        R_EMPTY,
+        R_CLASS,                        /* one byte out of cls[a] */
+        R_BOL,
+        R_EOL,
+        R_CAT,                          /* a, then the R_CAT list b (-1 ends it) */
+        R_ALT,                          /* a, or the R_ALT list b */
+        R_REP,                          /* a, min to max times, max -1 unbounded */
+};
+
+struct node
+{
+        int type;
+        int a;
+        int b;
+        int min;
+        int max;
+};
+
+struct bitset
+{
+        uint64_t w[4];
+};
+
+enum
+{
+        OP_CLASS,                       /* consume a byte of cls[y], go to x */
+        OP_SPLIT,                       /* go to x and y */
+        OP_JMP,
+        OP_BOL,
+        OP_EOL,
+        OP_MATCH,
+};
+
+struct inst
+{
+        int op;
+        int x;
+        int y;
+};
+
+struct regex
+{
+        uint64_t id;
+        struct inst *prog;
+        int nprog;
+        struct bitset *cls;
+        int ncls;
+        int has_bol;
+        char prefix[PREFIX_MAX];        /* every match starts with it */
+        size_t nprefix;
+};
+
+struct parser
+{
+        const char *p;
+        const char *err;
+        int depth;
+        struct node *nodes;
+        int nnodes;
+        int capnodes;
+        struct regex *re;
+        int capcls;
+        int capprog;
+};
+
+static inline int bit_test(const struct bitset *s, unsigned char c)
+{
+        return (int) (s->w[c >> 6] >> (c & 63) & 1);
+}
+
+static inline void bit_set(struct bitset *s, unsigned char c)
+{
+        s->w[c >> 6] |= 1ULL << (c & 63);
+}
+
+static int new_node(struct parser *ps, int type, int a, int b)
+{
+        if (ps->nnodes == ps->capnodes) {
+                int cap = ps->capnodes ? ps->capnodes * 2 : 64;
+                struct node *nodes = realloc(ps->nodes, (size_t) cap * sizeof(*nodes));
+                if (!nodes) {
+                        ps->err = "out of memory";
+                        return -1;
+                }
+                ps->nodes = nodes;
+                ps->capnodes = cap;
+        }
+
+        ps->nodes[ps->nnodes] = (struct node) { type, a, b, 1, 1 };
+
+        return ps->nnodes++;
+}
+
+static int new_class(struct parser *ps, const struct bitset *set)
+{
+        struct regex *re = ps->re;
+
+        if (re->ncls == ps->capcls) {
+                int cap = ps->capcls ? ps->capcls * 2 : 16;
+                struct bitset *cls = realloc(re->cls, (size_t) cap * sizeof(*cls));
+                if (!cls) {
+                        ps->err = "out of memory";
+                        return -1;
+                }
+                re->cls = cls;
+                ps->capcls = cap;
+        }
+
+        re->cls[re->ncls] = *set;
+
+        return new_node(ps, R_CLASS, re->ncls++, 0);
+}
+
+/* \d \w \s and their negations, 0 when 'c' names none of them */
+static int escape_class(char c, struct bitset *set)
+{
+        int (*is)(int);
+
+        switch (c) {
+        case 'd': case 'D': is = isdigit; break;
+        case 'w': case 'W': is = isalnum; break;
+        case 's': case 'S': is = isspace; break;
+        default: return 0;
+        }
+
+        for (int i = 0; i < 256; i++) {
+                int in = is(i) || ((c == 'w' || c == 'W') && i == '_');
+                if (in != (isupper((unsigned char) c) != 0))
+                        bit_set(set, (unsigned char) i);
+        }
+
+        return 1;
+}
+
+static int named_class(const char *name, size_t len, struct bitset *set)
+{
+        static const struct { const char *name; int (*is)(int); } names[] = {
+                { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+                { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+                { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+                { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+        };
+
+        for (size_t k = 0; k < sizeof(names) / sizeof(names[0]); k++) {
+                if (strlen(names[k].name) == len && memcmp(names[k].name, name, len) == 0) {
+                        for (int i = 0; i < 256; i++) {
+                                if (names[k].is(i))
+                                        bit_set(set, (unsigned char) i);
+                        }
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+/* The byte an escape stands for, -1 for an escape without meaning here:
+ * GNU's \b, \< or \1 are refused rather than taken as letters. */
+static int escape_byte(char c)
+{
+        switch (c) {
+        case 't': return '\t';
+        case 'n': return '\n';
+        case 'r': return '\r';
+        }
+
+        return c != '\0' && strchr("^.[]$()|*+?{}\\", c) ? (unsigned char) c : -1;
+}
+
+/* bracket expression, ps->p is past the '[', a backslash in it is just
+ * a byte as in POSIX */
+static int parse_bracket(struct parser *ps)
+{
+        struct bitset set = { { 0, 0, 0, 0 } };
+        int negate = 0;
+        int first = 1;
+
+        if (*ps->p == '^') {
+                negate = 1;
+                ps->p++;
+        }
+
+        while (first || *ps->p != ']') {
+                unsigned char lo, hi;
+
+                first = 0;
+
+                if (*ps->p == '\0') {
+                        ps->err = "missing ]";
+                        return -1;
+                }
+
+                if (ps->p[0] == '[' && ps->p[1] == ':') {
+                        const char *end = strstr(ps->p + 2, ":]");
+                        if (!end || !named_class(ps->p + 2, (size_t) (end - ps->p - 2), &set)) {
+                                ps->err = "unknown character class";
+                                return -1;
+                        }
+                        ps->p = end + 2;
+                        continue;
+                }
+
+                lo = (unsigned char) *ps->p++;
+                hi = lo;
+                if (ps->p[0] == '-' && ps->p[1] != ']' && ps->p[1] != '\0') {
+                        hi = (unsigned char) ps->p[1];
+                        ps->p += 2;
+                        if (hi < lo) {
+                                ps->err = "invalid range";
+                                return -1;
+                        }
+                }
+
+                for (int c = lo; c <= hi; c++)
+                        bit_set(&set, (unsigned char) c);
+        }
+
+        ps->p++;
+
+        if (negate) {
+                for (int i = 0; i < 4; i++)
+                        set.w[i] = ~set.w[i];
+        }
+
+        /* lines never hold a newline */
+        set.w['\n' >> 6] &= ~(1ULL << ('\n' & 63));
+
+        return new_class(ps, &set);
+}
+
+static int parse_alt(struct parser *ps);
+
+static int parse_atom(struct parser *ps)
+{
+        struct bitset set = { { 0, 0, 0, 0 } };
+        char c = *ps->p++;
+        int n;
+
+        switch (c) {
+        case '(':
+                if (++ps->depth > DEPTH_MAX) {
+                        ps->err = "pattern nested too deep";
+                        return -1;
+                }
+                n = parse_alt(ps);
+                if (n >= 0 && *ps->p != ')') {
+                        ps->err = "missing )";
+                        return -1;
+                }
+                ps->p++;
+                ps->depth--;
+                return n;
+        case '[':
+                return parse_bracket(ps);
+        case '.':
+                memset(&set, 0xff, sizeof(set));
+                set.w['\n' >> 6] &= ~(1ULL << ('\n' & 63));
+                return new_class(ps, &set);
+        case '^':
+                ps->re->has_bol = 1;
+                return new_node(ps, R_BOL, 0, 0);
+        case '$':
+                return new_node(ps, R_EOL, 0, 0);
+        case '*':
+        case '+':
+        case '?':
+                ps->err = "nothing to repeat";
+                return -1;
+        case '\\':
+                c = *ps->p++;
+                if (c == '\0') {
+                        ps->err = "trailing backslash";
+                        return -1;
+                }
+                if (escape_class(c, &set)) {
+                        set.w['\n' >> 6] &= ~(1ULL << ('\n' & 63));
+                        return new_class(ps, &set);
+                }
+                if (escape_byte(c) < 0) {
+                        ps->err = "unsupported escape";
+                        return -1;
+                }
+                bit_set(&set, (unsigned char) escape_byte(c));
+                return new_class(ps, &set);
+        default:
+                bit_set(&set, (unsigned char) c);
+                return new_class(ps, &set);
+        }
+}
+
+static int parse_int(struct parser *ps)
+{
+        int v = 0;
+
+        if (!isdigit((unsigned char) *ps->p))
+                return -1;
+
+        while (isdigit((unsigned char) *ps->p)) {
+                v = v * 10 + (*ps->p++ - '0');
+                if (v > REP_MAX)
+                        return -1;
+        }
+
+        return v;
+}
+
+/* {m}, {m,}, {m,n} or {,n} for {0,n}, ps->p is past the '{' */
+static int parse_bounds(struct parser *ps, int *min, int *max)
+{
+        *min = *ps->p == ',' ? 0 : parse_int(ps);
+        *max = *min;
+
+        if (*min >= 0 && *ps->p == ',') {
+                ps->p++;
+                *max = *ps->p == '}' ? -1 : parse_int(ps);
+                if (*max < -1 || (*max == -1 && *ps->p != '}'))
+                        *min = -1;
+        }
+
+        if (*min < 0 || *ps->p != '}' || (*max >= 0 && *max < *min)) {
+                ps->err = "invalid repetition bounds";
+                return -1;
+        }
+
+        ps->p++;
+
+        return 0;
+}
+
+static int parse_rep(struct parser *ps)
+{
+        int depth = ps->depth;
+        int n = parse_atom(ps);
+
+        while (n >= 0) {
+                int min, max;
+
+                if (*ps->p == '*' || *ps->p == '+' || *ps->p == '?') {
+                        min = *ps->p == '+';
+                        max = *ps->p == '?' ? 1 : -1;
+                        ps->p++;
+                } else if (*ps->p == '{' && (isdigit((unsigned char) ps->p[1])
+                                             || (ps->p[1] == ',' && isdigit((unsigned char) ps->p[2])))) {
+                        ps->p++;
+                        if (parse_bounds(ps, &min, &max) != 0)
+                                return -1;
+                } else {
+                        break;
+                }
+
+                if (++ps->depth > DEPTH_MAX) {
+                        ps->err = "pattern nested too deep";
+                        return -1;
+                }
+
+                n = new_node(ps, R_REP, n, 0);
+                if (n >= 0) {
+                        ps->nodes[n].min = min;
+                        ps->nodes[n].max = max;
+                }
+        }
+
+        ps->depth = depth;
+
+        return n;
+}
+
+/* Concatenation and alternation are kept as lists rather than trees, so
+ * long patterns don't recurse deeply. */
+static int parse_cat(struct parser *ps)
+{
+        int head = -1;
+        int tail = -1;
+
+        while (*ps->p != '\0' && *ps->p != '|' && *ps->p != ')') {
+                int n = parse_rep(ps);
+                if (n < 0)
+                        return -1;
+
+                int cat = new_node(ps, R_CAT, n, -1);
+                if (cat < 0)
+                        return -1;
+
+                if (tail >= 0)
+                        ps->nodes[tail].b = cat;
+                else
+                        head = cat;
+                tail = cat;
+        }
+
+        return head >= 0 ? head : new_node(ps, R_EMPTY, 0, 0);
+}
+
+static int parse_alt(struct parser *ps)
+{
+        int n = parse_cat(ps);
+        int head, tail;
+
+        if (n < 0 || *ps->p != '|')
+                return n;
+
+        head = tail = new_node(ps, R_ALT, n, -1);
+
+        while (tail >= 0 && *ps->p == '|') {
+                ps->p++;
+                n = parse_cat(ps);
+                if (n < 0)
+                        return -1;
+
+                int alt = new_node(ps, R_ALT, n, -1);
+                if (alt < 0)
+                        return -1;
+
+                ps->nodes[tail].b = alt;
+                tail = alt;
+        }
+
+        return tail >= 0 ? head : -1;
+}
+
+static int emit(struct parser *ps, int op, int x, int y)
+{
+        struct regex *re = ps->re;
+
+        if (re->nprog == PROG_MAX) {
+                ps->err = "pattern too large";
+                return -1;
+        }
+
+        if (re->nprog == ps->capprog) {
+                int cap = ps->capprog ? ps->capprog * 2 : 64;
+                struct inst *prog = realloc(re->prog, (size_t) cap * sizeof(*prog));
+                if (!prog) {
+                        ps->err = "out of memory";
+                        return -1;
+                }
+                re->prog = prog;
+                ps->capprog = cap;
+        }
+
+        re->prog[re->nprog] = (struct inst) { op, x, y };
+
+        return re->nprog++;
+}
+
+/* Thompson construction, every instruction but a jump falls through to
+ * the next one unless patched. */
+static int compile(struct parser *ps, int n)
+{
+        struct regex *re = ps->re;
+        const struct node *nd = &ps->nodes[n];
+        int pc;
+
+        switch (nd->type) {
+        case R_EMPTY:
+                return 0;
+        case R_CLASS:
+                return emit(ps, OP_CLASS, re->nprog + 1, nd->a) < 0 ? -1 : 0;
+        case R_BOL:
+                return emit(ps, OP_BOL, re->nprog + 1, 0) < 0 ? -1 : 0;
+        case R_EOL:
+                return emit(ps, OP_EOL, re->nprog + 1, 0) < 0 ? -1 : 0;
+        case R_CAT:
+                for (; n >= 0; n = ps->nodes[n].b) {
+                        if (compile(ps, ps->nodes[n].a) != 0)
+                                return -1;
+                }
+                return 0;
+        case R_ALT: {
+                int first = re->nprog;
+
+                /* each branch but the last is split off and jumps past
+                 * the end, the jumps are chained through 'y' until then */
+                int jumps = -1;
+                for (; ps->nodes[n].b >= 0; n = ps->nodes[n].b) {
+                        int split = emit(ps, OP_SPLIT, re->nprog + 1, 0);
+                        if (split < 0 || compile(ps, ps->nodes[n].a) != 0)
+                                return -1;
+                        int jmp = emit(ps, OP_JMP, 0, jumps);
+                        if (jmp < 0)
+                                return -1;
+                        jumps = jmp;
+                        re->prog[split].y = re->nprog;
+                }
+                if (compile(ps, ps->nodes[n].a) != 0)
+                        return -1;
+                while (jumps >= first) {
+                        int next = re->prog[jumps].y;
+                        re->prog[jumps].x = re->nprog;
+                        jumps = next;
+                }
+                return 0;
+        }
+        case R_REP: {
+                int body = nd->a;
+                int min = nd->min;
+                int max = nd->max;
+
+                for (int i = 0; i < min; i++) {
+                        if (compile(ps, body) != 0)
+                                return -1;
+                }
+
+                if (max < 0) {
+                        /* L: split L+1, out; body; jmp L */
+                        pc = emit(ps, OP_SPLIT, re->nprog + 1, 0);
+                        if (pc < 0 || compile(ps, body) != 0 || emit(ps, OP_JMP, pc, 0) < 0)
+                                return -1;
+                        re->prog[pc].y = re->nprog;
+                        return 0;
+                }
+
+                /* optional copies, each split skips to the very end */
+                int first = re->nprog;
+                for (int i = min; i < max; i++) {
+                        if (emit(ps, OP_SPLIT, re->nprog + 1, -1) < 0 || compile(ps, body) != 0)
+                                return -1;
+                }
+                for (pc = first; pc < re->nprog; pc++) {
+                        if (re->prog[pc].op == OP_SPLIT && re->prog[pc].y == -1)
+                                re->prog[pc].y = re->nprog;
+                }
+                return 0;
+        }
+        }
+
+        return -1;
+}
+
+/* Collect the literal every match starts with, return non-zero when the
+ * whole of node 'n' was literal so the caller may go on after it. */
+static int literal_prefix(const struct parser *ps, int n, struct regex *re)
+{
+        const struct node *nd = &ps->nodes[n];
+
+        switch (nd->type) {
+        case R_EMPTY:
+                return 1;
+        case R_CLASS: {
+                const struct bitset *set = &re->cls[nd->a];
+                int count = 0;
+                unsigned char c = 0;
+
+                for (int i = 0; i < 256 && count < 2; i++) {
+                        if (bit_test(set, (unsigned char) i)) {
+                                c = (unsigned char) i;
+                                count++;
+                        }
+                }
+
+                if (count != 1 || re->nprefix == PREFIX_MAX)
+                        return 0;
+                re->prefix[re->nprefix++] = (char) c;
+                return 1;
+        }
+        case R_CAT:
+                for (; n >= 0; n = ps->nodes[n].b) {
+                        if (!literal_prefix(ps, ps->nodes[n].a, re))
+                                return 0;
+                }
+                return 1;
+        default:
+                return 0;
+        }
+}
+
+static uint64_t regex_ids;
+
+struct regex *regex_compile(const char *pattern, const char **err)
+{
+        struct parser ps;
+        struct regex *re = calloc(1, sizeof(*re));
+        int root;
+
+        if (!re) {
+                *err = "out of memory";
+                return NULL;
+        }
+
+        memset(&ps, 0, sizeof(ps));
+        ps.p = pattern;
+        ps.re = re;
+
+        root = parse_alt(&ps);
+        if (root >= 0 && *ps.p != '\0') {
+                ps.err = "unmatched )";
+                root = -1;
+        }
+
+        if (root >= 0 && (compile(&ps, root) != 0 || emit(&ps, OP_MATCH, 0, 0) < 0))
+                root = -1;
+
+        if (root < 0) {
+                *err = ps.err;
+                free(ps.nodes);
+                regex_free(re);
+                return NULL;
+        }
+
+        literal_prefix(&ps, root, re);
+        re->id = ++regex_ids;
+        free(ps.nodes);
+
+        return re;
+}
+
+void regex_free(struct regex *re)
+{
+        if (re) {
+                free(re->prog);
+                free(re->cls);
+                free(re);
+        }
+}
+
+struct dstate
+{
+        int32_t next[256];              /* -1 until computed */
+        int match;                      /* a match ended, the line matches */
+        int eol_match;                  /* the line matches if it ends here */
+        int nset;
+        int *set;                       /* sorted OP_CLASS, OP_EOL and OP_MATCH */
+        uint32_t hash;
+};
+
+struct dfa
+{
+        const struct regex *re;
+        uint64_t id;
+        struct dstate *st;
+        int nst;
+        int *table;                     /* open addressing, 2 * DFA_STATES */
+        int *setmem;
+        size_t nsetmem;
+        int start_bol;
+        int start_mid;
+        /* closure scratch */
+        unsigned int gen;
+        unsigned int *mark;
+        int *stack;
+        int *tmp;
+        int ntmp;
+        int *save;
+};
+
+#define TABLE_SIZE (2 * DFA_STATES)
+
+/* Add the closure of 'pc' to d->tmp. A '^' is passed only at a line
+ * start and a '$' only at its end, otherwise it is kept in the set. */
+static void closure(struct dfa *d, int pc, int bol, int eol)
+{
+        const struct inst *prog = d->re->prog;
+        int sp = 0;
+
+        d->stack[sp++] = pc;
+
+        while (sp) {
+                pc = d->stack[--sp];
+                if (d->mark[pc] == d->gen)
+                        continue;
+                d->mark[pc] = d->gen;
+
+                switch (prog[pc].op) {
+                case OP_JMP:
+                        d->stack[sp++] = prog[pc].x;
+                        break;
+                case OP_SPLIT:
+                        d->stack[sp++] = prog[pc].y;
+                        d->stack[sp++] = prog[pc].x;
+                        break;
+                case OP_BOL:
+                        if (bol)
+                                d->stack[sp++] = prog[pc].x;
+                        break;
+                case OP_EOL:
+                        if (eol)
+                                d->stack[sp++] = prog[pc].x;
+                        else
+                                d->tmp[d->ntmp++] = pc;
+                        break;
+                default:
+                        d->tmp[d->ntmp++] = pc;
+                        break;
+                }
+        }
+}
+
+static void closure_begin(struct dfa *d)
+{
+        if (++d->gen == 0) {
+                memset(d->mark, 0, (size_t) d->re->nprog * sizeof(*d->mark));
+                d->gen = 1;
+        }
+        d->ntmp = 0;
+}
+
+static int cmp_int(const void *a, const void *b)
+{
+        int x = *(const int *) a;
+        int y = *(const int *) b;
+
+        return (x > y) - (x < y);
+}
+
+static uint32_t set_hash(const int *set, int n)
+{
+        uint32_t h = 2166136261u;
+
+        for (int i = 0; i < n; i++)
+                h = (h ^ (uint32_t) set[i]) * 16777619u;
+
+        return h;
+}
+
+/* Find or add the state of the sorted 'set', -1 when the cache is full. */
+static int dfa_add(struct dfa *d, const int *set, int n)
+{
+        const struct inst *prog = d->re->prog;
+        uint32_t h = set_hash(set, n);
+        uint32_t i = h & (TABLE_SIZE - 1);
+
+        for (; d->table[i] >= 0; i = (i + 1) & (TABLE_SIZE - 1)) {
+                const struct dstate *ds = &d->st[d->table[i]];
+                if (ds->hash == h && ds->nset == n && memcmp(ds->set, set, (size_t) n * sizeof(*set)) == 0)
+                        return d->table[i];
+        }
+
+        if (d->nst == DFA_STATES || d->nsetmem + (size_t) n > DFA_SETMEM)
+                return -1;
+
+        struct dstate *ds = &d->st[d->nst];
+        memset(ds->next, 0xff, sizeof(ds->next));
+        ds->set = d->setmem + d->nsetmem;
+        ds->nset = n;
+        ds->hash = h;
+        memcpy(ds->set, set, (size_t) n * sizeof(*set));
+        d->nsetmem += (size_t) n;
+
+        ds->match = 0;
+        for (int k = 0; k < n; k++)
+                ds->match |= prog[set[k]].op == OP_MATCH;
+
+        /* would a line ending here pass its '$' to a match */
+        closure_begin(d);
+        for (int k = 0; k < n; k++) {
+                if (prog[set[k]].op == OP_EOL)
+                        closure(d, prog[set[k]].x, 0, 1);
+        }
+        ds->eol_match = 0;
+        for (int k = 0; k < d->ntmp; k++)
+                ds->eol_match |= prog[d->tmp[k]].op == OP_MATCH;
+
+        d->table[i] = d->nst;
+
+        return d->nst++;
+}
+
+static int add_tmp(struct dfa *d)
+{
+        qsort(d->tmp, (size_t) d->ntmp, sizeof(*d->tmp), cmp_int);
+        return dfa_add(d, d->tmp, d->ntmp);
+}
+
+static void dfa_flush(struct dfa *d)
+{
+        d->nst = 0;
+        d->nsetmem = 0;
+        memset(d->table, 0xff, TABLE_SIZE * sizeof(*d->table));
+
+        closure_begin(d);
+        closure(d, 0, 1, 0);
+        d->start_bol = add_tmp(d);
+
+        /* a match may start anywhere, so every state holds this one */
+        closure_begin(d);
+        closure(d, 0, 0, 0);
+        d->start_mid = add_tmp(d);
+}
+
+/* State of 'set', flushing the cache first when it is full. */
+static int dfa_state(struct dfa *d, const int *set, int n)
+{
+        int s = dfa_add(d, set, n);
+
+        if (s < 0) {
+                dfa_flush(d);
+                s = dfa_add(d, set, n);
+        }
+
+        return s;
+}
+
+static int dfa_next(struct dfa *d, int s, unsigned char c)
+{
+        const struct regex *re = d->re;
+        const struct dstate *ds = &d->st[s];
+
+        closure_begin(d);
+        for (int k = 0; k < ds->nset; k++) {
+                const struct inst *in = &re->prog[ds->set[k]];
+                if (in->op == OP_CLASS && bit_test(&re->cls[in->y], c))
+                        closure(d, in->x, 0, 0);
+        }
+        closure(d, 0, 0, 0);
+
+        qsort(d->tmp, (size_t) d->ntmp, sizeof(*d->tmp), cmp_int);
+
+        int t = dfa_add(d, d->tmp, d->ntmp);
+        if (t >= 0) {
+                d->st[s].next[c] = t;
+                return t;
+        }
+
+        /* the flush reuses tmp */
+        int n = d->ntmp;
+        memcpy(d->save, d->tmp, (size_t) n * sizeof(*d->tmp));
+        dfa_flush(d);
+
+        return dfa_add(d, d->save, n);
+}
+
+static void dfa_destroy(void *_d)
+{
+        struct dfa *d = _d;
+
+        if (d) {
+                free(d->st);
+                free(d->table);
+                free(d->setmem);
+                free(d->mark);
+                free(d->stack);
+                free(d->tmp);
+                free(d->save);
+                free(d);
+        }
+}
+
+static struct dfa *dfa_create(const struct regex *re)
+{
+        struct dfa *d = calloc(1, sizeof(*d));
+        size_t n = (size_t) re->nprog;
+
+        if (!d)
+                return NULL;
+
+        d->re = re;
+        d->id = re->id;
+        d->st = malloc(DFA_STATES * sizeof(*d->st));
+        d->table = malloc(TABLE_SIZE * sizeof(*d->table));
+        d->setmem = malloc(DFA_SETMEM * sizeof(*d->setmem));
+        d->mark = calloc(n, sizeof(*d->mark));
+        d->stack = malloc(3 * n * sizeof(*d->stack));
+        d->tmp = malloc(n * sizeof(*d->tmp));
+        d->save = malloc(n * sizeof(*d->save));
+
+        if (!d->st || !d->table || !d->setmem || !d->mark || !d->stack || !d->tmp || !d->save) {
+                dfa_destroy(d);
+                return NULL;
+        }
+
+        dfa_flush(d);
+
+        return d;
+}
+
+static pthread_key_t dfa_key;
+static pthread_once_t dfa_once = PTHREAD_ONCE_INIT;
+
+static void dfa_key_init(void)
+{
+        PANIC_IF(pthread_key_create(&dfa_key, dfa_destroy) != 0, "ERROR: pthread_key_create\n");
+}
+
+/* Every thread builds its own DFA, so states are added without locks and
+ * stay warm across all the files a worker counts. */
+static struct dfa *dfa_get(const struct regex *re)
+{
+        struct dfa *d;
+
+        pthread_once(&dfa_once, dfa_key_init);
+
+        d = pthread_getspecific(dfa_key);
+        if (d && d->id == re->id)
+                return d;
+
+        dfa_destroy(d);
+        d = dfa_create(re);
+        PANIC_IF(!d, "ERROR: out of memory\n");
+        pthread_setspecific(dfa_key, d);
+
+        return d;
+}
+
+struct regex_state *regex_state_new(const struct regex *re)
+{
+        struct regex_state *rs = calloc(1, sizeof(*rs) + (size_t) re->nprog * sizeof(rs->set[0]));
+
+        if (rs)
+                rs->re = re;
+
+        return rs;
+}
+
+void regex_state_free(struct regex_state *rs)
+{
+        free(rs);
+}
+
+void regex_reset(struct regex_state *rs)
+{
+        rs->matched = 0;
+        rs->mid = 0;
+}
+
+/* First occurrence of the literal prefix in buf[0, n), with the same
+ * first and last byte filter as -p. */
+static const char *find_prefix(const struct regex *re, const char *buf, size_t n)
+{
+        uint64_t bits[PREFIX_WINDOW / 64];
+        size_t gap = re->nprefix - 1;
+        unsigned char a = (unsigned char) re->prefix[0];
+        unsigned char b = (unsigned char) re->prefix[gap];
+
+        for (size_t off = 0; off + gap < n; off += PREFIX_WINDOW) {
+                size_t len = n - off < PREFIX_WINDOW + gap ? n - off : PREFIX_WINDOW + gap;
+
+                simd_find_pair(buf + off, len, gap, a, b, bits);
+
+                for (size_t w = 0; w < (len - gap + 63) / 64; w++) {
+                        for (uint64_t m = bits[w]; m; m &= m - 1) {
+                                const char *p = buf + off + w * 64 + (size_t) __builtin_ctzll(m);
+                                if (memcmp(p, re->prefix, re->nprefix) == 0)
+                                        return p;
+                        }
+                }
+        }
+
+        return NULL;
+}
+
+void regex_feed(struct regex_state *rs, const char *buf, size_t n)
+{
+        const struct regex *re = rs->re;
+        struct dfa *d = dfa_get(re);
+        const struct dstate *st = d->st;
+        int scan = re->nprefix > 0 && !re->has_bol;
+        ptrdiff_t hit = -1;
+        size_t i = 0;
+        int s;
+
+        if (n == 0)
+                return;
+
+        /* the rest of a line that matched already */
+        if (rs->matched) {
+                const char *nl = memchr(buf, '\n', n);
+                if (!nl)
+                        return;
+                i = (size_t) (nl - buf) + 1;
+                rs->matched = 0;
+                rs->mid = 0;
+        }
+
+        s = rs->mid ? dfa_state(d, rs->set, rs->nset) : d->start_bol;
+
+        while (i < n) {
+                if (st[s].match) {
+                        rs->lines++;
+                        const char *nl = memchr(buf + i, '\n', n - i);
+                        if (!nl) {
+                                rs->matched = 1;
+                                rs->mid = 1;
+                                return;
+                        }
+                        i = (size_t) (nl - buf) + 1;
+                        s = d->start_bol;
+                        continue;
+                }
+
+                /* nothing partial, jump to the next place a match can
+                 * start, the lines in between can't match */
+                if (scan && s == d->start_mid) {
+                        if ((ptrdiff_t) i > hit) {
+                                const char *p = find_prefix(re, buf + i, n - i);
+                                if (p) {
+                                        hit = p - buf;
+                                } else {
+                                        /* a prefix may still start in the last bytes */
+                                        if (n - i >= re->nprefix)
+                                                i = n - (re->nprefix - 1);
+                                        scan = 0;
+                                        continue;
+                                }
+                        }
+                        i = (size_t) hit;
+                }
+
+                /* no thread left alive, as after a failed '^' */
+                if (st[s].nset == 0) {
+                        const char *nl = memchr(buf + i, '\n', n - i);
+                        i = nl ? (size_t) (nl - buf) : n;
+                        if (!nl)
+                                break;
+                }
+
+                unsigned char c = (unsigned char) buf[i++];
+
+                if (c == '\n') {
+                        rs->lines += st[s].eol_match;
+                        s = d->start_bol;
+                        continue;
+                }
+
+                int t = st[s].next[c];
+                s = t >= 0 ? t : dfa_next(d, s, c);
+        }
+
+        /* a state just reached may be a match of the open line */
+        rs->mid = buf[n - 1] != '\n';
+        if (rs->mid) {
+                if (st[s].match) {
+                        rs->lines++;
+                        rs->matched = 1;
+                        return;
+                }
+                rs->nset = st[s].nset;
+                memcpy(rs->set, st[s].set, (size_t) st[s].nset * sizeof(rs->set[0]));
+        }
+}
+
+void regex_finish(struct regex_state *rs)
+{
+        if (rs->mid && !rs->matched) {
+                struct dfa *d = dfa_get(rs->re);
+                int s = dfa_state(d, rs->set, rs->nset);
+
+                rs->lines += d->st[s].match || d->st[s].eol_match;
+        }
+
+        regex_reset(rs);
+}
+
+void regex_merge(struct regex_state *dst, const struct regex_state *src)
+{
+        dst->lines += src->lines;
+
+        /* 'src' is the later range, its open line is the open one now */
+        dst->matched = src->matched;
+        dst->mid = src->mid;
+        dst->nset = src->nset;
+        memcpy(dst->set, src->set, (size_t) src->nset * sizeof(src->set[0]));
+}
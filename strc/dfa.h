@@ -0,0 +1,53 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * dfa - count lines matching an extended regular expression
+ *
+ * The pattern is compiled to a Thompson NFA which is turned into a DFA
+ * lazily, one state per new set of NFA states met in the input. States
+ * live in a bounded per-thread cache that is flushed when full, so time
+ * stays linear in the input whatever the pattern and memory stays
+ * bounded. A literal every match starts with is searched for first
+ * to skip lines that cannot match.
+ *
+ * Supported is POSIX ERE over bytes: . [] [^] [:class:] ^ $ ( ) | * + ?
+ * {m,n} and {,n}, escaped metacharacters and the escapes \d \w \s \D \W
+ * \S \t. Any other escape, such as GNU's \b \< \> or a back-reference,
+ * is refused. Inside brackets a backslash is an ordinary byte as in POSIX.
+ * '.' matches one byte, not one UTF-8 character.
+ */
+#ifndef DFA_H_
+#define DFA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* compiled pattern, shared read-only by every state */
+struct regex;
+
+struct regex_state
+{
+        const struct regex *re;
+        uint64_t lines;                 /* lines matching */
+        int matched;                    /* the open line matched already */
+        int mid;                        /* the open line is not at its start */
+        int nset;
+        int set[];                      /* NFA states of the open line */
+};
+
+/* Compile 'pattern', on failure return NULL with '*err' set to a message. */
+struct regex *regex_compile(const char *pattern, const char **err);
+void regex_free(struct regex *re);
+
+struct regex_state *regex_state_new(const struct regex *re);
+void regex_state_free(struct regex_state *rs);
+/* Forget the bytes fed so far, the next buffer starts a new line. */
+void regex_reset(struct regex_state *rs);
+void regex_feed(struct regex_state *rs, const char *buf, size_t n);
+/* The stream has ended, match its unterminated last line against '$'. */
+void regex_finish(struct regex_state *rs);
+/* Add the totals of 'src', which continues the stream of 'dst'. */
+void regex_merge(struct regex_state *dst, const struct regex_state *src);
+
+#endif /* DFA_H_ */
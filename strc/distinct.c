@@ -0,0 +1,236 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#include "distinct.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <r9k/panic.h>
+
+#include "hash.h"
+#include "util.h"
+
+/* 2^14 registers, standard error 1.04 / sqrt(2^14) */
+#define HLL_BITS 14
+#define HLL_REGS ((size_t) 1 << HLL_BITS)
+
+struct set
+{
+        struct registry_node node;      /* all sets, for the final merge */
+
+        uint8_t *regs;                  /* sketch */
+        struct keyset keys;             /* exact */
+};
+
+static size_t key_field;
+static int exact_keys;
+
+static struct registry sets = REGISTRY_INIT;
+
+void distinct_setup(size_t field, int exact)
+{
+        key_field = field;
+        exact_keys = exact;
+        registry_init(&sets);
+}
+
+/* the top bits pick a register, which keeps the longest run of leading
+ * zeros seen in the rest */
+static inline void hll_add(uint8_t *regs, uint64_t h)
+{
+        size_t r = (size_t) (h >> (64 - HLL_BITS));
+        uint64_t w = h << HLL_BITS;
+        uint8_t rank = w ? (uint8_t) (__builtin_clzll(w) + 1) : 64 - HLL_BITS + 1;
+
+        if (rank > regs[r])
+                regs[r] = rank;
+}
+
+static double hll_estimate(const uint8_t *regs)
+{
+        double m = (double) HLL_REGS;
+        double sum = 0;
+        size_t zeros = 0;
+
+        for (size_t i = 0; i < HLL_REGS; i++) {
+                sum += ldexp(1.0, -regs[i]);
+                zeros += regs[i] == 0;
+        }
+
+        double est = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+
+        /* few keys, linear counting on the empty registers is closer */
+        if (est <= 2.5 * m && zeros)
+                est = m * log(m / (double) zeros);
+
+        return est;
+}
+
+/* The set of the calling thread, it outlives the thread so the keys are
+ * still there to merge. */
+static struct set *thread_set(void)
+{
+        struct set *s = registry_get(&sets);
+
+        if (s)
+                return s;
+
+        s = calloc(1, sizeof(*s));
+        PANIC_IF(!s, "ERROR: out of memory\n");
+        if (!exact_keys) {
+                s->regs = calloc(HLL_REGS, 1);
+                PANIC_IF(!s->regs, "ERROR: out of memory\n");
+        }
+        registry_add(&sets, &s->node);
+
+        return s;
+}
+
+static void set_free(struct set *s)
+{
+        keyset_free(&s->keys);
+        free(s->regs);
+        free(s);
+}
+
+struct distinct_state *distinct_state_new(void)
+{
+        return calloc(1, sizeof(struct distinct_state));
+}
+
+void distinct_state_free(struct distinct_state *ds)
+{
+        if (ds) {
+                free(ds->part.buf);
+                free(ds);
+        }
+}
+
+void distinct_reset(struct distinct_state *ds)
+{
+        ds->part.len = 0;
+}
+
+static void add_key(struct set *s, const char *key, size_t len)
+{
+        uint64_t h = hash_bytes(key, len);
+
+        if (s->regs)
+                hll_add(s->regs, h);
+        else
+                keyset_add(&s->keys, key, len, h, 1);
+}
+
+/* the line buf[0, len), or its field */
+static void add_line(struct set *s, const char *line, size_t len)
+{
+        if (!key_field) {
+                add_key(s, line, len);
+                return;
+        }
+
+        size_t i = 0;
+        for (size_t f = 1;; f++) {
+                while (i < len && is_ws((unsigned char) line[i]))
+                        i++;
+                if (i == len)
+                        return;
+
+                size_t start = i;
+                while (i < len && !is_ws((unsigned char) line[i]))
+                        i++;
+
+                if (f == key_field) {
+                        add_key(s, line + start, i - start);
+                        return;
+                }
+        }
+}
+
+/* a line ending at buf[len], joined to the open part if any */
+static void count_line(struct set *s, struct distinct_state *ds, const char *buf, size_t len)
+{
+        if (ds->part.len) {
+                part_append(&ds->part, buf, len);
+                buf = ds->part.buf;
+                len = ds->part.len;
+                ds->part.len = 0;
+        }
+
+        add_line(s, buf, len);
+}
+
+void distinct_feed(struct distinct_state *ds, const char *buf, size_t n)
+{
+        struct set *s = thread_set();
+        size_t i = 0;
+
+        while (i < n) {
+                const char *nl = memchr(buf + i, '\n', n - i);
+                if (!nl) {
+                        part_append(&ds->part, buf + i, n - i);
+                        return;
+                }
+
+                size_t len = (size_t) (nl - (buf + i));
+                count_line(s, ds, buf + i, len);
+                i += len + 1;
+        }
+}
+
+void distinct_merge(struct distinct_state *dst, const struct distinct_state *src)
+{
+        dst->part.len = 0;
+        if (src->part.len)
+                part_append(&dst->part, src->part.buf, src->part.len);
+}
+
+void distinct_finish(struct distinct_state *ds)
+{
+        if (ds->part.len) {
+                count_line(thread_set(), ds, NULL, 0);
+                ds->part.len = 0;
+        }
+}
+
+void distinct_print(void)
+{
+        struct set *all = (struct set *) registry_take(&sets);
+        const char *what = key_field ? "fields" : "lines";
+
+        if (!all) {
+                printf("%8d distinct %s\n", 0, what);
+                return;
+        }
+
+        for (struct set *s = (struct set *) all->node.next; s; s = (struct set *) s->node.next) {
+                if (all->regs) {
+                        for (size_t i = 0; i < HLL_REGS; i++) {
+                                if (s->regs[i] > all->regs[i])
+                                        all->regs[i] = s->regs[i];
+                        }
+                } else {
+                        for (size_t i = 0; i < s->keys.cap; i++) {
+                                const struct key_entry *e = &s->keys.slots[i];
+                                if (e->count)
+                                        keyset_add(&all->keys, e->key, e->len, e->hash, e->count);
+                        }
+                }
+        }
+
+        if (all->regs)
+                printf("%8.0f distinct %s (estimated, error about %.1f%%)\n", hll_estimate(all->regs),
+                       what, 104.0 / sqrt((double) HLL_REGS));
+        else
+                printf("%8zu distinct %s\n", all->keys.n, what);
+
+        while (all) {
+                struct set *next = (struct set *) all->node.next;
+                set_free(all);
+                all = next;
+        }
+}
@@ -0,0 +1,137 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#define _GNU_SOURCE /* pread, posix_fadvise */
+#include "estimate.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "simd.h"
+
+/* 128 blocks of 64kb, 8mb read whatever the size */
+#define EST_BLOCKS 128
+#define EST_BLOCK  ((size_t) 64 << 10)
+
+/* two sided 95% of the normal distribution */
+#define EST_Z 1.96
+
+static int read_block(int fd, char *buf, off_t off, size_t *n)
+{
+        size_t got = 0;
+
+        while (got < *n) {
+                ssize_t r = pread(fd, buf + got, *n - got, off + (off_t) got);
+                if (r < 0 && errno == EINTR)
+                        continue;
+                if (r < 0)
+                        return errno;
+                if (r == 0)
+                        break;
+                got += (size_t) r;
+        }
+
+        *n = got;
+
+        return 0;
+}
+
+/* the whole file fits in the sample, count it */
+static int count_all(int fd, char *buf, off_t size, struct estimate *est)
+{
+        for (off_t off = 0; off < size; off += (off_t) EST_BLOCK) {
+                size_t n = size - off < (off_t) EST_BLOCK ? (size_t) (size - off) : EST_BLOCK;
+                int err = read_block(fd, buf, off, &n);
+                if (err != 0)
+                        return err;
+                est->seen += simd_count_byte(buf, n, '\n');
+                est->sampled += n;
+                if (n == 0)
+                        break;
+        }
+
+        est->lines = est->seen;
+
+        return 0;
+}
+
+int estimate_lines(int fd, off_t size, struct estimate *est)
+{
+        char *buf = malloc(EST_BLOCK);
+        uint64_t counts[EST_BLOCKS];
+        int err = 0;
+
+        memset(est, 0, sizeof(*est));
+        est->size = (uint64_t) size;
+
+        if (!buf)
+                return ENOMEM;
+
+        if ((uint64_t) size <= (uint64_t) EST_BLOCKS * EST_BLOCK) {
+                err = count_all(fd, buf, size, est);
+                free(buf);
+                return err;
+        }
+
+        /* systematic sample, first and last block included */
+        off_t step = (size - (off_t) EST_BLOCK) / (EST_BLOCKS - 1);
+
+        /* let the device fetch every block at once */
+        for (int i = 0; i < EST_BLOCKS; i++)
+                posix_fadvise(fd, (off_t) i * step, (off_t) EST_BLOCK, POSIX_FADV_WILLNEED);
+
+        for (int i = 0; i < EST_BLOCKS; i++) {
+                size_t n = EST_BLOCK;
+
+                err = read_block(fd, buf, (off_t) i * step, &n);
+                if (err != 0)
+                        break;
+                if (n != EST_BLOCK) {
+                        err = EIO;      /* shrank under us */
+                        break;
+                }
+
+                counts[i] = simd_count_byte(buf, n, '\n');
+                est->seen += counts[i];
+                est->sampled += n;
+        }
+
+        free(buf);
+
+        if (err != 0)
+                return err;
+
+        /* the file as N blocks, of which n were drawn */
+        double N = (double) size / (double) EST_BLOCK;
+        double n = EST_BLOCKS;
+        double mean = (double) est->seen / n;
+        double ss = 0;
+
+        for (int i = 0; i < EST_BLOCKS; i++)
+                ss += ((double) counts[i] - mean) * ((double) counts[i] - mean);
+
+        est->lines = (uint64_t) llround(mean * N);
+        est->var = N * N * (ss / (n - 1)) / n * (1 - n / N);
+
+        return 0;
+}
+
+void estimate_interval(const struct estimate *est, uint64_t *lo, uint64_t *hi)
+{
+        double half = EST_Z * sqrt(est->var);
+        double l = (double) est->lines - half;
+        double h = (double) est->lines + half;
+
+        /* what was not read holds at most one newline per byte */
+        uint64_t max = est->seen + (est->size - est->sampled);
+
+        *lo = l > (double) est->seen ? (uint64_t) l : est->seen;
+        *hi = h < (double) max ? (uint64_t) ceil(h) : max;
+        if (*hi < *lo)
+                *hi = *lo;
+}
@@ -0,0 +1,34 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * estimate - approximate line count of a huge file from a sample
+ *
+ * A fixed number of evenly spaced blocks is read with pread(), so the cost
+ * does not grow with the file. The newline density of the blocks is
+ * extrapolated to st_size, and the spread between blocks gives a normal
+ * confidence interval. Files no bigger than the sample are counted whole.
+ */
+#ifndef ESTIMATE_H_
+#define ESTIMATE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct estimate
+{
+        uint64_t lines;                 /* point estimate */
+        double var;                     /* its variance, 0 when exact */
+        uint64_t seen;                  /* newlines in the blocks read */
+        uint64_t sampled;               /* bytes read */
+        uint64_t size;
+};
+
+/* Estimate the newlines in the first 'size' bytes of the regular file
+ * 'fd'. Return 0 on success otherwise an errno value. */
+int estimate_lines(int fd, off_t size, struct estimate *est);
+
+/* The 95% interval of 'est', never below what was seen. */
+void estimate_interval(const struct estimate *est, uint64_t *lo, uint64_t *hi);
+
+#endif /* ESTIMATE_H_ */
@@ -0,0 +1,337 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#define _GNU_SOURCE /* clock_gettime, PATH_MAX */
+#include "follow.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <r9k/compiler_attrs.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "counter.h"
+
+#define FILE_EVENTS (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#define DIR_EVENTS  (IN_CREATE | IN_MOVED_TO)
+
+struct followed
+{
+        const char *path;
+        const char *base;               /* file name inside its directory */
+        int fd;                         /* -1 while the path is missing */
+        dev_t dev;
+        ino_t ino;
+        off_t pos;                      /* bytes of the open file counted */
+        int wd;                         /* inotify watch of the file */
+        int dir_wd;                     /* inotify watch of its directory */
+        int dirty;
+        uint64_t last;                  /* primary metric at the last tick */
+        struct counter ctr;             /* totals across rotations */
+};
+
+struct follow
+{
+        struct followed *files;
+        uint32_t nfiles;
+        struct source_opts opts;        /* never mmap, the file may shrink */
+        int ifd;                        /* inotify instance, -1 if none */
+};
+
+static double now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void watch_file(struct follow *fw, struct followed *fl)
+{
+#ifdef __linux__
+        if (fw->ifd >= 0 && fl->fd >= 0)
+                fl->wd = inotify_add_watch(fw->ifd, fl->path, FILE_EVENTS);
+#else
+        __attr_ignore2(fw, fl);
+#endif
+}
+
+static void watch_dir(struct follow *fw, struct followed *fl)
+{
+#ifdef __linux__
+        char dir[PATH_MAX];
+        const char *slash = strrchr(fl->path, '/');
+
+        if (fw->ifd < 0)
+                return;
+
+        if (!slash) {
+                strcpy(dir, ".");
+        } else {
+                size_t len = slash == fl->path ? 1 : (size_t) (slash - fl->path);
+                if (len >= sizeof(dir))
+                        return;
+                memcpy(dir, fl->path, len);
+                dir[len] = '\0';
+        }
+
+        fl->dir_wd = inotify_add_watch(fw->ifd, dir, DIR_EVENTS);
+#else
+        __attr_ignore2(fw, fl);
+#endif
+}
+
+static int open_file(struct follow *fw, struct followed *fl)
+{
+        struct stat st;
+
+        /* non-blocking, so draining a FIFO stops when it runs dry */
+        fl->fd = open(fl->path, O_RDONLY | O_NONBLOCK);
+        if (fl->fd < 0)
+                return errno;
+
+        if (fstat(fl->fd, &st) != 0) {
+                int err = errno;
+                close(fl->fd);
+                fl->fd = -1;
+                return err;
+        }
+
+        fl->dev = st.st_dev;
+        fl->ino = st.st_ino;
+        fl->pos = 0;
+        /* a new file never continues a word or line of the old one */
+        counter_finish(&fl->ctr);
+        counter_seed(&fl->ctr, -1);
+        watch_file(fw, fl);
+
+        return 0;
+}
+
+static void close_file(struct follow *fw, struct followed *fl)
+{
+#ifdef __linux__
+        if (fw->ifd >= 0 && fl->wd >= 0)
+                inotify_rm_watch(fw->ifd, fl->wd);
+#else
+        __attr_ignore(fw);
+#endif
+        fl->wd = -1;
+        close(fl->fd);
+        fl->fd = -1;
+}
+
+/* Count whatever the open file gained since the last look. */
+static void drain(struct follow *fw, struct followed *fl)
+{
+        struct stat st;
+        int err = 0;
+
+        if (fl->fd < 0 || fstat(fl->fd, &st) != 0)
+                return;
+
+        /* truncated in place (copytruncate), start over */
+        if (st.st_size < fl->pos) {
+                fl->pos = 0;
+                counter_finish(&fl->ctr);
+                counter_seed(&fl->ctr, -1);
+        }
+
+        /* pipes and FIFOs have no size, read what is there */
+        if (!S_ISREG(st.st_mode)) {
+                err = source_count_fd(fl->fd, &fw->opts, &fl->ctr);
+        } else if (st.st_size > fl->pos) {
+                /* a failed range is skipped, what was fed of it stays counted */
+                err = source_count_range(fl->fd, fl->pos, st.st_size, &fw->opts, &fl->ctr);
+                fl->pos = st.st_size;
+        }
+
+        /* EAGAIN is a FIFO that ran dry */
+        if (err != 0 && err != EAGAIN)
+                fprintf(stderr, "WARNING: %s: %s\n", fl->path, strerror(err));
+}
+
+/* Drain the file and follow its path to a new inode after a rotation. */
+static void check(struct follow *fw, struct followed *fl)
+{
+        struct stat st;
+
+        drain(fw, fl);
+
+        if (stat(fl->path, &st) != 0)
+                return;
+
+        if (fl->fd >= 0 && st.st_dev == fl->dev && st.st_ino == fl->ino)
+                return;
+
+        if (fl->fd >= 0)
+                close_file(fw, fl);
+
+        if (open_file(fw, fl) == 0)
+                drain(fw, fl);
+}
+
+#ifdef __linux__
+/* Mark the files touched by pending inotify events as dirty. */
+static void read_events(struct follow *fw)
+{
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t n;
+
+        while ((n = read(fw->ifd, buf, sizeof(buf))) > 0) {
+                for (char *p = buf; p < buf + n; ) {
+                        struct inotify_event *ev = (struct inotify_event *) p;
+
+                        for (uint32_t i = 0; i < fw->nfiles; i++) {
+                                struct followed *fl = &fw->files[i];
+                                if (ev->wd == fl->wd
+                                    || (ev->wd == fl->dir_wd && ev->len && strcmp(ev->name, fl->base) == 0))
+                                        fl->dirty = 1;
+                        }
+
+                        /* the queue overflowed, look at everything */
+                        if (ev->mask & IN_Q_OVERFLOW) {
+                                for (uint32_t i = 0; i < fw->nfiles; i++)
+                                        fw->files[i].dirty = 1;
+                        }
+
+                        p += sizeof(struct inotify_event) + ev->len;
+                }
+        }
+}
+#endif
+
+static void report(struct follow *fw, double elapsed)
+{
+        struct counter total;
+        char name[PATH_MAX + 32];
+        uint64_t last = 0;
+
+        counter_init(&total, fw->files[0].ctr.flags);
+        counter_total(&total);
+
+        for (uint32_t i = 0; i < fw->nfiles; i++) {
+                struct followed *fl = &fw->files[i];
+                uint64_t cur = counter_primary(&fl->ctr);
+
+                snprintf(name, sizeof(name), "%10.1f/s %s", (double) (cur - fl->last) / elapsed, fl->path);
+                counter_print(&fl->ctr, name);
+
+                counter_merge(&total, &fl->ctr);
+                last += fl->last;
+                fl->last = cur;
+        }
+
+        if (fw->nfiles > 1) {
+                snprintf(name, sizeof(name), "%10.1f/s total", (double) (counter_primary(&total) - last) / elapsed);
+                counter_print(&total, name);
+        }
+
+        counter_free(&total);
+        fflush(stdout);
+}
+
+/* Release the first 'n' files and the rest of the state. */
+static void follow_free(struct follow *fw, uint32_t n)
+{
+        for (uint32_t i = 0; i < n; i++) {
+                if (fw->files[i].fd >= 0)
+                        close(fw->files[i].fd);
+                counter_free(&fw->files[i].ctr);
+        }
+
+        /* closing the instance drops its watches */
+        if (fw->ifd >= 0)
+                close(fw->ifd);
+        free(fw->files);
+}
+
+int follow_run(const char **paths, uint32_t npaths, unsigned int flags,
+               const struct source_opts *opts, double interval, const char **failed)
+{
+        struct follow fw;
+        double tick, t, prev;
+        int err;
+
+        *failed = NULL;
+        fw.nfiles = npaths;
+        fw.opts = *opts;
+        /* pread, a mapping of a file truncated under us faults with SIGBUS */
+        fw.opts.no_mmap = 1;
+        fw.ifd = -1;
+        fw.files = calloc(npaths, sizeof(*fw.files));
+        if (!fw.files)
+                return ENOMEM;
+
+#ifdef __linux__
+        fw.ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+
+        for (uint32_t i = 0; i < npaths; i++) {
+                struct followed *fl = &fw.files[i];
+                const char *slash = strrchr(paths[i], '/');
+
+                fl->path = paths[i];
+                fl->base = slash ? slash + 1 : paths[i];
+                fl->wd = -1;
+                fl->dir_wd = -1;
+                counter_init(&fl->ctr, flags);
+
+                err = open_file(&fw, fl);
+                if (err != 0) {
+                        *failed = fl->path;
+                        follow_free(&fw, i + 1);
+                        return err;
+                }
+
+                watch_dir(&fw, fl);
+                drain(&fw, fl);
+                fl->last = counter_primary(&fl->ctr);
+        }
+
+        prev = now();
+        tick = prev + interval;
+
+        for (;;) {
+                struct pollfd pfd = { fw.ifd, POLLIN, 0 };
+                double wait = (tick - now()) * 1000;
+                /* a long --interval is waited out in INT_MAX steps */
+                int timeout = wait <= 0 ? 0 : wait >= INT_MAX ? INT_MAX : (int) wait;
+
+                /* without inotify this is a plain sleep */
+                if (poll(&pfd, fw.ifd >= 0 ? 1 : 0, timeout) > 0) {
+#ifdef __linux__
+                        read_events(&fw);
+#endif
+                        for (uint32_t i = 0; i < fw.nfiles; i++) {
+                                if (fw.files[i].dirty) {
+                                        fw.files[i].dirty = 0;
+                                        check(&fw, &fw.files[i]);
+                                }
+                        }
+                }
+
+                t = now();
+                if (t < tick)
+                        continue;
+
+                /* the periodic look catches what inotify missed */
+                for (uint32_t i = 0; i < fw.nfiles; i++)
+                        check(&fw, &fw.files[i]);
+
+                report(&fw, t - prev);
+                prev = t;
+                tick = t + interval;
+        }
+}
@@ -0,0 +1,27 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * follow - keep counting files as they grow
+ *
+ * Every file stays open and only bytes appended since the last look are
+ * counted. On Linux inotify wakes the loop when a file or its directory
+ * changes, a periodic check catches anything inotify cannot report.
+ * A file replaced under its path (rotation) is drained and reopened, a
+ * truncated one is counted again from its start.
+ */
+#ifndef FOLLOW_H_
+#define FOLLOW_H_
+
+#include <stdint.h>
+
+#include "source.h"
+
+/* Follow 'paths' until killed, printing running totals and the rate of
+ * the first requested metric every 'interval' seconds. Only returns on
+ * setup failure, with an errno value and '*failed' set to the path that
+ * could not be opened, NULL when none. */
+int follow_run(const char **paths, uint32_t npaths, unsigned int flags,
+               const struct source_opts *opts, double interval, const char **failed);
+
+#endif /* FOLLOW_H_ */
@@ -0,0 +1,61 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * hash - fast non-cryptographic hash of byte spans
+ *
+ * 16 bytes per step folded with a 64x64->128 bit multiply, in the style
+ * of wyhash. Good enough for hash tables and sketches, not for anything
+ * facing an adversary.
+ */
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HASH_K0 0xa0761d6478bd642fULL
+#define HASH_K1 0xe7037ed1a0b428dbULL
+#define HASH_K2 0x8ebc6af09c88c6e3ULL
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b)
+{
+        __uint128_t r = (__uint128_t) a * b;
+
+        return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
+
+static inline uint64_t hash_read64(const unsigned char *p)
+{
+        uint64_t v;
+
+        memcpy(&v, p, sizeof(v));
+
+        return v;
+}
+
+static inline uint64_t hash_bytes(const void *data, size_t n)
+{
+        const unsigned char *p = data;
+        uint64_t h = HASH_K0 ^ (uint64_t) n;
+
+        for (; n >= 16; p += 16, n -= 16)
+                h = hash_mix(hash_read64(p) ^ HASH_K1, hash_read64(p + 8) ^ h);
+
+        if (n >= 8) {
+                h = hash_mix(hash_read64(p) ^ HASH_K1, h ^ HASH_K2);
+                p += 8;
+                n -= 8;
+        }
+
+        if (n) {
+                uint64_t v = 0;
+                memcpy(&v, p, n);
+                h = hash_mix(v ^ HASH_K2, h ^ HASH_K1);
+        }
+
+        return hash_mix(h ^ HASH_K0, h ^ HASH_K2);
+}
+
+#endif /* HASH_H_ */
@@ -0,0 +1,422 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#define _GNU_SOURCE /* pread, pwrite, ftruncate, st_mtim */
+#include "lineidx.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <r9k/panic.h>
+
+#include "cache.h"
+#include "simd.h"
+
+#define LINEIDX_MAGIC "STRCIDX1"
+#define SKIP_BLOCK    ((size_t) 1 << 10) /* counted at once while looking for a sample */
+#define COPY_BUF      ((size_t) 64 << 10) /* 64kb */
+#define VARINT_MAX    10
+
+#ifdef __APPLE__
+#  define ST_MTIM(st) ((st)->st_mtimespec)
+#else
+#  define ST_MTIM(st) ((st)->st_mtim)
+#endif
+
+struct lineidx_header
+{
+        char     magic[8];
+        uint64_t dev;
+        uint64_t ino;
+        int64_t  size;                  /* bytes indexed */
+        int64_t  mtime_sec;
+        int64_t  mtime_nsec;
+        uint64_t fp;                    /* hash of the bytes before 'size' */
+        int32_t  last;
+        uint32_t step;
+        uint64_t lines;                 /* newlines before 'size' */
+        uint64_t count;                 /* samples */
+        uint64_t len;                   /* bytes of deltas after the header */
+        uint64_t last_line;             /* the last sample, base of the next delta */
+        uint64_t last_off;
+};
+
+static uint64_t sample_step = LINEIDX_STEP;
+
+void lineidx_setup(uint64_t step)
+{
+        sample_step = step;
+}
+
+struct lineidx_state *lineidx_state_new(void)
+{
+        return calloc(1, sizeof(struct lineidx_state));
+}
+
+void lineidx_state_free(struct lineidx_state *ix)
+{
+        if (ix) {
+                free(ix->e);
+                free(ix);
+        }
+}
+
+static void push(struct lineidx_state *ix, uint64_t line, uint64_t off)
+{
+        if (ix->n == ix->cap) {
+                size_t cap = ix->cap ? ix->cap * 2 : 256;
+                struct lineidx_entry *e = realloc(ix->e, cap * sizeof(*e));
+                PANIC_IF(!e, "ERROR: out of memory\n");
+                ix->e = e;
+                ix->cap = cap;
+        }
+
+        ix->e[ix->n++] = (struct lineidx_entry) { line, off };
+}
+
+/* the line after the 'k'th newline of buf[0, n), 1-based, which is there */
+static size_t after_newline(const char *buf, size_t n, uint64_t k)
+{
+        size_t i = 0;
+
+        for (;;) {
+                size_t len = n - i < SKIP_BLOCK ? n - i : SKIP_BLOCK;
+                uint64_t c = simd_count_byte(buf + i, len, '\n');
+                if (c >= k)
+                        break;
+                k -= c;
+                i += len;
+        }
+
+        for (;;) {
+                const char *nl = memchr(buf + i, '\n', n - i);
+                i = (size_t) (nl - buf) + 1;
+                if (--k == 0)
+                        return i;
+        }
+}
+
+void lineidx_feed(struct lineidx_state *ix, const char *buf, size_t n, uint64_t newlines)
+{
+        /* samples follow every step-th newline of the stream */
+        uint64_t next = (ix->lines / sample_step + 1) * sample_step;
+        uint64_t seen = ix->lines;
+        size_t at = 0;
+
+        for (; next <= ix->lines + newlines; next += sample_step) {
+                at += after_newline(buf + at, n - at, next - seen);
+                seen = next;
+                push(ix, next, ix->pos + at);
+        }
+
+        ix->lines += newlines;
+        ix->pos += n;
+}
+
+void lineidx_merge(struct lineidx_state *dst, const struct lineidx_state *src)
+{
+        for (size_t i = 0; i < src->n; i++)
+                push(dst, dst->lines + src->e[i].line, dst->pos + src->e[i].off);
+
+        dst->lines += src->lines;
+        dst->pos += src->pos;
+}
+
+static char *sidecar_path(const char *path, const char *ext)
+{
+        size_t len = strlen(path);
+        char *s = malloc(len + strlen(LINEIDX_SUFFIX) + strlen(ext) + 1);
+
+        if (s) {
+                memcpy(s, path, len);
+                strcpy(s + len, LINEIDX_SUFFIX);
+                strcat(s + len, ext);
+        }
+
+        return s;
+}
+
+/* Open the index of 'path' and read its header, -1 when there is none or
+ * it is for another file or a rewritten one. */
+static int open_index(const char *path, int fd, const struct stat *st, struct lineidx_header *h)
+{
+        char *ipath = sidecar_path(path, "");
+        int last;
+
+        if (!ipath)
+                return -1;
+
+        int ifd = open(ipath, O_RDONLY);
+        free(ipath);
+        if (ifd < 0)
+                return -1;
+
+        if (pread(ifd, h, sizeof(*h), 0) != (ssize_t) sizeof(*h)
+            || memcmp(h->magic, LINEIDX_MAGIC, sizeof(h->magic)) != 0
+            || h->dev != (uint64_t) st->st_dev || h->ino != (uint64_t) st->st_ino
+            || h->size > st->st_size)
+                goto miss;
+
+        /* same size, then same mtime; grown, then same old tail */
+        if (h->size == st->st_size
+            ? ST_MTIM(st).tv_sec != h->mtime_sec || ST_MTIM(st).tv_nsec != h->mtime_nsec
+            : cache_fingerprint(fd, (off_t) h->size, &last) != h->fp || last != h->last)
+                goto miss;
+
+        return ifd;
+
+miss:
+        close(ifd);
+        return -1;
+}
+
+int lineidx_lookup(const char *path, int fd, const struct stat *st, struct lineidx_cover *cov)
+{
+        struct lineidx_header h;
+        int ifd = open_index(path, fd, st, &h);
+
+        if (ifd < 0)
+                return LINEIDX_MISS;
+        close(ifd);
+
+        /* samples are extended at the same step only */
+        if (h.step != sample_step)
+                return LINEIDX_MISS;
+
+        cov->size = (off_t) h.size;
+        cov->last = h.last;
+        cov->lines = h.lines;
+
+        return h.size == st->st_size ? LINEIDX_HIT : LINEIDX_GROWN;
+}
+
+static size_t put_varint(unsigned char *p, uint64_t v)
+{
+        size_t n = 0;
+
+        while (v >= 0x80) {
+                p[n++] = (unsigned char) (v | 0x80);
+                v >>= 7;
+        }
+        p[n++] = (unsigned char) v;
+
+        return n;
+}
+
+/* Return the bytes read, 0 for a truncated varint. */
+static size_t get_varint(const unsigned char *p, size_t n, uint64_t *v)
+{
+        *v = 0;
+        for (size_t i = 0; i < n && i < VARINT_MAX; i++) {
+                *v |= (uint64_t) (p[i] & 0x7f) << (7 * i);
+                if (!(p[i] & 0x80))
+                        return i + 1;
+        }
+
+        return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t n, off_t off)
+{
+        const char *p = buf;
+
+        while (n > 0) {
+                ssize_t w = pwrite(fd, p, n, off);
+                if (w < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return errno;
+                }
+                p += w;
+                n -= (size_t) w;
+                off += w;
+        }
+
+        return 0;
+}
+
+int lineidx_store(const char *path, int fd, const struct stat *st, const struct lineidx_state *ix, int grown)
+{
+        struct lineidx_header h;
+        char *ipath = sidecar_path(path, "");
+        char *tmp = sidecar_path(path, ".tmp");
+        unsigned char *deltas = malloc(ix->n * 2 * VARINT_MAX + 1);
+        int ifd = -1;
+        int err = ENOMEM;
+
+        if (!ipath || !tmp || !deltas)
+                goto out;
+
+        if (grown) {
+                /* append behind the samples the header counts, dropping
+                 * whatever an interrupted run left after them */
+                ifd = open(ipath, O_RDWR);
+                if (ifd < 0 || flock(ifd, LOCK_EX) != 0)
+                        goto fail;
+                if (pread(ifd, &h, sizeof(h), 0) != (ssize_t) sizeof(h)
+                    || memcmp(h.magic, LINEIDX_MAGIC, sizeof(h.magic)) != 0) {
+                        err = EINVAL;
+                        goto out;
+                }
+                if (ftruncate(ifd, (off_t) (sizeof(h) + h.len)) != 0)
+                        goto fail;
+        } else {
+                /* a new index replaces the old one whole */
+                ifd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (ifd < 0)
+                        goto fail;
+                memset(&h, 0, sizeof(h));
+                memcpy(h.magic, LINEIDX_MAGIC, sizeof(h.magic));
+        }
+
+        size_t len = 0;
+        for (size_t i = 0; i < ix->n; i++) {
+                len += put_varint(deltas + len, ix->e[i].line - h.last_line);
+                len += put_varint(deltas + len, ix->e[i].off - h.last_off);
+                h.last_line = ix->e[i].line;
+                h.last_off = ix->e[i].off;
+        }
+
+        err = write_all(ifd, deltas, len, (off_t) (sizeof(h) + h.len));
+        if (err != 0)
+                goto out;
+
+        h.dev = (uint64_t) st->st_dev;
+        h.ino = (uint64_t) st->st_ino;
+        h.size = st->st_size;
+        h.mtime_sec = ST_MTIM(st).tv_sec;
+        h.mtime_nsec = ST_MTIM(st).tv_nsec;
+        h.fp = cache_fingerprint(fd, st->st_size, &h.last);
+        h.step = (uint32_t) sample_step;
+        h.lines = ix->lines;
+        h.count += ix->n;
+        h.len += len;
+
+        /* the header goes last, it commits the samples */
+        err = write_all(ifd, &h, sizeof(h), 0);
+        if (err == 0 && !grown && rename(tmp, ipath) != 0)
+                err = errno;
+        goto out;
+
+fail:
+        err = errno;
+out:
+        if (ifd >= 0)
+                close(ifd);
+        if (err != 0 && !grown && tmp)
+                unlink(tmp);
+        free(deltas);
+        free(tmp);
+        free(ipath);
+
+        return err;
+}
+
+/* The last sample at or before 'line' newlines, from index 'ifd'. */
+static void find_sample(int ifd, const struct lineidx_header *h, uint64_t line, struct lineidx_entry *at)
+{
+        unsigned char buf[COPY_BUF];
+        struct lineidx_entry cur = { 0, 0 };
+        uint64_t left = h->len;
+        off_t off = sizeof(*h);
+        size_t have = 0;
+
+        while (left > 0 || have > 0) {
+                if (have < 2 * VARINT_MAX && left > 0) {
+                        size_t want = sizeof(buf) - have < left ? sizeof(buf) - have : (size_t) left;
+                        ssize_t got = pread(ifd, buf + have, want, off);
+                        if (got <= 0)
+                                return;
+                        have += (size_t) got;
+                        left -= (uint64_t) got;
+                        off += got;
+                }
+
+                uint64_t dl, doff;
+                size_t i = 0;
+                while (have - i >= 2 * VARINT_MAX || (left == 0 && i < have)) {
+                        size_t a = get_varint(buf + i, have - i, &dl);
+                        size_t b = a ? get_varint(buf + i + a, have - i - a, &doff) : 0;
+                        if (!b)
+                                return;
+                        cur.line += dl;
+                        cur.off += doff;
+                        if (cur.line > line)
+                                return;
+                        *at = cur;
+                        i += a + b;
+                }
+
+                memmove(buf, buf + i, have - i);
+                have -= i;
+        }
+}
+
+int lineidx_print(const char *path, int fd, uint64_t first, uint64_t last, int *indexed)
+{
+        struct lineidx_header h;
+        struct lineidx_entry at = { 0, 0 };
+        struct stat st;
+        char buf[COPY_BUF];
+
+        if (fstat(fd, &st) != 0)
+                return errno;
+
+        int ifd = open_index(path, fd, &st, &h);
+        *indexed = ifd >= 0;
+        if (ifd >= 0) {
+                find_sample(ifd, &h, first - 1, &at);
+                close(ifd);
+        }
+
+        uint64_t line = at.line;        /* newlines before buf[0] */
+        off_t off = (off_t) at.off;
+
+        while (line < last) {
+                ssize_t got = pread(fd, buf, sizeof(buf), off);
+                if (got < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return errno;
+                }
+                if (got == 0)
+                        break;
+
+                size_t n = (size_t) got;
+                size_t i = 0;
+                off += got;
+
+                /* whole buffers before the first line go by in one count */
+                if (line + 1 < first) {
+                        uint64_t c = simd_count_byte(buf, n, '\n');
+                        if (line + c < first - 1) {
+                                line += c;
+                                continue;
+                        }
+                }
+
+                for (; line + 1 < first; line++)
+                        i = (size_t) ((const char *) memchr(buf + i, '\n', n - i) - buf) + 1;
+
+                size_t from = i;
+                while (line < last && i < n) {
+                        const char *nl = memchr(buf + i, '\n', n - i);
+                        if (!nl) {
+                                i = n;
+                                break;
+                        }
+                        i = (size_t) (nl - buf) + 1;
+                        line++;
+                }
+
+                if (fwrite(buf + from, 1, i - from, stdout) != i - from)
+                        return EIO;
+        }
+
+        return fflush(stdout) == 0 ? 0 : errno;
+}
@@ -0,0 +1,77 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * lineidx - sidecar index of sampled line offsets
+ *
+ * While lines are counted the offset of every Nth line start is kept, and
+ * written next to the file in <file>.sidx as varint deltas behind a header
+ * naming the file and the bytes covered. A lookup decodes the deltas up to
+ * the last sample before the wanted line and reads on from there with
+ * pread, so any line costs at most a step of lines instead of a rescan.
+ * The header keeps the cache's tail fingerprint: when the file only grew,
+ * the new samples are appended and the header rewritten after them.
+ */
+#ifndef LINEIDX_H_
+#define LINEIDX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define LINEIDX_STEP                         4096 /* default lines between samples */
+#define LINEIDX_SUFFIX                       ".sidx"
+
+/* lookup result */
+#define LINEIDX_MISS                         0 /* index the whole file */
+#define LINEIDX_HIT                          1 /* the index is current */
+#define LINEIDX_GROWN                        2 /* index from 'size' on and append */
+
+struct lineidx_entry
+{
+        uint64_t line;                  /* newlines before the sampled line */
+        uint64_t off;                   /* its offset */
+};
+
+/* Per stream state, samples in stream offsets. */
+struct lineidx_state
+{
+        uint64_t pos;                   /* bytes fed */
+        uint64_t lines;                 /* newlines fed */
+        struct lineidx_entry *e;
+        size_t n;
+        size_t cap;
+};
+
+struct lineidx_cover
+{
+        off_t size;                     /* bytes indexed */
+        int last;                       /* byte at size - 1 */
+        uint64_t lines;                 /* newlines in them */
+};
+
+/* Sample every 'step' lines. Must be called before any line is counted. */
+void lineidx_setup(uint64_t step);
+
+struct lineidx_state *lineidx_state_new(void);
+void lineidx_state_free(struct lineidx_state *ix);
+/* 'buf' holds 'newlines' newlines, as counted by the caller. */
+void lineidx_feed(struct lineidx_state *ix, const char *buf, size_t n, uint64_t newlines);
+/* 'src' continues the stream of 'dst', rebase and take its samples. */
+void lineidx_merge(struct lineidx_state *dst, const struct lineidx_state *src);
+
+/* Look up the index of 'path', open as 'fd' and described by 'st'. */
+int lineidx_lookup(const char *path, int fd, const struct stat *st, struct lineidx_cover *cov);
+/* Write the index of the first st->st_size bytes of 'fd' from the samples
+ * of 'ix', or with 'grown' append those past the indexed size.
+ * Return 0 on success otherwise an errno value. */
+int lineidx_store(const char *path, int fd, const struct stat *st, const struct lineidx_state *ix, int grown);
+
+/* Copy lines 'first' to 'last', 1-based and inclusive, of 'fd' to stdout,
+ * starting from the closest sample of the index of 'path'. 'indexed' tells
+ * whether the index was usable. Return 0 on success otherwise an errno
+ * value. */
+int lineidx_print(const char *path, int fd, uint64_t first, uint64_t last, int *indexed);
+
+#endif /* LINEIDX_H_ */
@@ -0,0 +1,237 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#include "match.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simd.h"
+
+/* Buffers are searched in slices, so the candidate bitmaps fit on the
+ * stack and the slice stays in cache while every literal is tried. */
+#define MATCH_SLICE ((size_t) 64 << 10) /* 64kb */
+#define MATCH_WORDS (MATCH_SLICE / 64)
+
+struct literal
+{
+        const char *s;
+        size_t len;
+};
+
+struct matcher
+{
+        size_t n;
+        size_t maxlen;
+        struct literal lit[];
+};
+
+struct matcher *match_compile(const char **lits, size_t n)
+{
+        struct matcher *m = malloc(sizeof(*m) + n * sizeof(m->lit[0]));
+
+        if (!m)
+                return NULL;
+
+        m->n = n;
+        m->maxlen = 0;
+
+        for (size_t i = 0; i < n; i++) {
+                size_t len = strlen(lits[i]);
+
+                if (len == 0 || memchr(lits[i], '\n', len)) {
+                        free(m);
+                        errno = EINVAL;
+                        return NULL;
+                }
+
+                m->lit[i].s = lits[i];
+                m->lit[i].len = len;
+                if (len > m->maxlen)
+                        m->maxlen = len;
+        }
+
+        return m;
+}
+
+void match_free(struct matcher *m)
+{
+        free(m);
+}
+
+struct match_state *match_state_new(const struct matcher *m)
+{
+        struct match_state *ms = calloc(1, sizeof(*ms) + m->n * sizeof(ms->next[0]));
+
+        if (!ms)
+                return NULL;
+
+        /* the tail is joined with the head of the next buffer in place */
+        ms->tail = malloc(2 * m->maxlen);
+        if (!ms->tail) {
+                free(ms);
+                return NULL;
+        }
+
+        ms->m = m;
+
+        return ms;
+}
+
+void match_state_free(struct match_state *ms)
+{
+        if (ms) {
+                free(ms->tail);
+                free(ms);
+        }
+}
+
+void match_reset(struct match_state *ms)
+{
+        ms->ntail = 0;
+        ms->open = 0;
+        ms->line_end = ms->pos;
+}
+
+/* An occurrence at stream offset 'at', count its line unless that was
+ * done already. Hits come in offset order, so only the last counted line
+ * needs remembering. 'buf' is the slice at ms->pos. */
+static void line_hit(struct match_state *ms, uint64_t at, const char *buf, size_t n)
+{
+        if (ms->open || at < ms->line_end)
+                return;
+
+        ms->lines++;
+
+        size_t from = at > ms->pos ? (size_t) (at - ms->pos) : 0;
+        const char *nl = memchr(buf + from, '\n', n - from);
+        if (nl)
+                ms->line_end = ms->pos + (uint64_t) (nl - buf);
+        else
+                ms->open = 1;
+}
+
+static int occurrence(struct match_state *ms, size_t k, uint64_t at)
+{
+        if (at < ms->next[k])
+                return 0;
+
+        ms->hits++;
+        ms->next[k] = at + ms->m->lit[k].len;
+
+        return 1;
+}
+
+/* Occurrences starting in the tail and ending in 'buf'. */
+static void search_boundary(struct match_state *ms, const char *buf, size_t n)
+{
+        const struct matcher *m = ms->m;
+        size_t head = n < m->maxlen - 1 ? n : m->maxlen - 1;
+        uint64_t base = ms->pos - ms->ntail;
+        char *joined = ms->tail;
+
+        memcpy(joined + ms->ntail, buf, head);
+
+        for (size_t s = 0; s < ms->ntail; s++) {
+                int hit = 0;
+
+                for (size_t k = 0; k < m->n; k++) {
+                        const struct literal *lit = &m->lit[k];
+
+                        if (s + lit->len <= ms->ntail || s + lit->len > ms->ntail + head)
+                                continue;
+                        if (memcmp(joined + s, lit->s, lit->len) == 0)
+                                hit |= occurrence(ms, k, base + s);
+                }
+
+                if (hit)
+                        line_hit(ms, base + s, buf, n);
+        }
+}
+
+/* keep the last maxlen - 1 bytes of the stream */
+static void save_tail(struct match_state *ms, const char *buf, size_t n)
+{
+        size_t keep = ms->m->maxlen - 1;
+
+        if (n >= keep) {
+                memcpy(ms->tail, buf + n - keep, keep);
+                ms->ntail = keep;
+                return;
+        }
+
+        if (ms->ntail + n > keep) {
+                size_t drop = ms->ntail + n - keep;
+                memmove(ms->tail, ms->tail + drop, ms->ntail - drop);
+                ms->ntail -= drop;
+        }
+
+        memcpy(ms->tail + ms->ntail, buf, n);
+        ms->ntail += n;
+}
+
+static void search_slice(struct match_state *ms, const char *buf, size_t n)
+{
+        const struct matcher *m = ms->m;
+        uint64_t cand[MATCH_WORDS];
+        uint64_t hit[MATCH_WORDS];
+        size_t nwords = (n + 63) / 64;
+
+        if (ms->ntail)
+                search_boundary(ms, buf, n);
+
+        /* the counted line may end in this slice */
+        if (ms->open) {
+                const char *nl = memchr(buf, '\n', n);
+                if (nl) {
+                        ms->open = 0;
+                        ms->line_end = ms->pos + (uint64_t) (nl - buf);
+                }
+        }
+
+        memset(hit, 0, nwords * sizeof(hit[0]));
+
+        for (size_t k = 0; k < m->n; k++) {
+                const struct literal *lit = &m->lit[k];
+
+                if (n < lit->len)
+                        continue;
+
+                simd_find_pair(buf, n, lit->len - 1, (unsigned char) lit->s[0],
+                               (unsigned char) lit->s[lit->len - 1], cand);
+
+                for (size_t w = 0; w < (n - lit->len + 64) / 64; w++) {
+                        for (uint64_t bits = cand[w]; bits; bits &= bits - 1) {
+                                size_t at = w * 64 + (size_t) __builtin_ctzll(bits);
+
+                                if (memcmp(buf + at, lit->s, lit->len) == 0
+                                    && occurrence(ms, k, ms->pos + at))
+                                        hit[w] |= 1ULL << (at % 64);
+                        }
+                }
+        }
+
+        /* lines are counted in offset order, whichever literal hit */
+        for (size_t w = 0; w < nwords; w++) {
+                for (uint64_t bits = hit[w]; bits; bits &= bits - 1)
+                        line_hit(ms, ms->pos + w * 64 + (size_t) __builtin_ctzll(bits), buf, n);
+        }
+
+        if (m->maxlen > 1)
+                save_tail(ms, buf, n);
+        ms->pos += n;
+}
+
+void match_feed(struct match_state *ms, const char *buf, size_t n)
+{
+        for (size_t off = 0; off < n; off += MATCH_SLICE)
+                search_slice(ms, buf + off, n - off < MATCH_SLICE ? n - off : MATCH_SLICE);
+}
+
+void match_merge(struct match_state *dst, const struct match_state *src)
+{
+        dst->lines += src->lines;
+        dst->hits += src->hits;
+}
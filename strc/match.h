@@ -0,0 +1,47 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * match - count lines and occurrences of literal strings
+ *
+ * Candidates for each literal are found with a vectorized filter on its
+ * first and last byte, then verified with memcmp(). Literals never hold a
+ * newline, so a stream cut at line boundaries can be searched in pieces
+ * and the results added up.
+ */
+#ifndef MATCH_H_
+#define MATCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* compiled set of literals, shared read-only by every state */
+struct matcher;
+
+struct match_state
+{
+        const struct matcher *m;
+        uint64_t lines;                 /* lines holding any literal */
+        uint64_t hits;                  /* occurrences, non-overlapping per literal */
+        uint64_t pos;                   /* stream offset of the next byte fed */
+        uint64_t line_end;              /* offset of the newline ending the last counted line */
+        int open;                       /* ... which was not seen yet */
+        size_t ntail;
+        char *tail;                     /* last bytes fed, for occurrences across buffers */
+        uint64_t next[];                /* per literal, where the next occurrence may start */
+};
+
+/* Compile 'n' literals, none of them empty or holding a newline. Return
+ * NULL on failure with errno set. */
+struct matcher *match_compile(const char **lits, size_t n);
+void match_free(struct matcher *m);
+
+struct match_state *match_state_new(const struct matcher *m);
+void match_state_free(struct match_state *ms);
+/* Forget the bytes fed so far, the next buffer starts a new line. */
+void match_reset(struct match_state *ms);
+void match_feed(struct match_state *ms, const char *buf, size_t n);
+/* Add the totals of 'src' to 'dst'. */
+void match_merge(struct match_state *dst, const struct match_state *src);
+
+#endif /* MATCH_H_ */
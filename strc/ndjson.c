@@ -0,0 +1,360 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#include "ndjson.h"
+
+#include <string.h>
+
+#include "simd.h"
+#include "util.h"
+
+/* bitmaps of one slice live on the stack, 2 x 4 words per 64 bytes */
+#define NDJSON_SLICE ((size_t) 8 << 10) /* 8kb */
+#define NDJSON_WORDS (NDJSON_SLICE / 64)
+
+enum { B_QUOTE, B_BSLASH, B_NL };
+
+enum { NJ_OK, NJ_STRING, NJ_TRUNCATED, NJ_UNBALANCED, NJ_TRAILING, NJ_DEEP, NJ_ESCAPE, NJ_VALUE };
+
+/* a top-level value that is not a container, checked byte by byte */
+enum { SC_NONE, SC_STRING, SC_WORD, SC_MINUS, SC_ZERO, SC_INT, SC_DOT, SC_FRAC, SC_E, SC_ESIGN, SC_EXP };
+
+/* the carriage return is only whitespace, it fills the last slot */
+static const unsigned char text_bytes[4] = { '"', '\\', '\n', '\r' };
+static const unsigned char bracket_bytes[4] = { '{', '}', '[', ']' };
+
+static int seen_malformed;
+
+const char *ndjson_error(int why)
+{
+        switch (why) {
+        case NJ_STRING:     return "unterminated string";
+        case NJ_TRUNCATED:  return "truncated";
+        case NJ_UNBALANCED: return "unbalanced brackets";
+        case NJ_TRAILING:   return "more than one value";
+        case NJ_DEEP:       return "nested too deep";
+        case NJ_ESCAPE:     return "backslash outside a string";
+        case NJ_VALUE:      return "not a JSON value";
+        default:            return "ok";
+        }
+}
+
+int ndjson_seen_malformed(void)
+{
+        return __atomic_load_n(&seen_malformed, __ATOMIC_RELAXED);
+}
+
+/* the escape carry belongs to the word, not the line */
+static void line_reset(struct ndjson_state *js)
+{
+        js->why = NJ_OK;
+        js->filled = 0;
+        js->values = 0;
+        js->in_string = 0;
+        js->scalar = SC_NONE;
+        js->word = NULL;
+        js->depth = 0;
+}
+
+void ndjson_reset(struct ndjson_state *js)
+{
+        line_reset(js);
+        js->escaped = 0;
+}
+
+static void add_bad(struct ndjson_state *js, uint64_t line, int why)
+{
+        js->malformed++;
+        if (js->nbad < NDJSON_REPORT)
+                js->bad[js->nbad++] = (struct ndjson_bad) { line, why };
+}
+
+/* The first byte of the line that is not whitespace starts its value. */
+static void value_start(struct ndjson_state *js, unsigned char c)
+{
+        js->filled = 1;
+
+        switch (c) {
+        case '{':
+        case '[':
+                break;
+        case '"': js->scalar = SC_STRING; break;
+        case 't': js->scalar = SC_WORD; js->word = "rue"; break;
+        case 'f': js->scalar = SC_WORD; js->word = "alse"; break;
+        case 'n': js->scalar = SC_WORD; js->word = "ull"; break;
+        case '-': js->scalar = SC_MINUS; break;
+        case '0': js->scalar = SC_ZERO; break;
+        default:
+                if (c >= '1' && c <= '9')
+                        js->scalar = SC_INT;
+                else
+                        js->why = NJ_VALUE;
+        }
+}
+
+/* One more byte of a number or literal, -1 when it cannot go on. */
+static int scalar_step(struct ndjson_state *js, unsigned char c)
+{
+        int digit = c >= '0' && c <= '9';
+        int exp = c == 'e' || c == 'E';
+        int st = -1;
+
+        if (js->scalar == SC_WORD) {
+                if (*js->word != (char) c)
+                        return -1;
+                js->word++;
+                return 0;
+        }
+
+        switch (js->scalar) {
+        case SC_MINUS: st = c == '0' ? SC_ZERO : digit ? SC_INT : -1; break;
+        case SC_ZERO:  st = c == '.' ? SC_DOT : exp ? SC_E : -1; break;
+        case SC_INT:   st = digit ? SC_INT : c == '.' ? SC_DOT : exp ? SC_E : -1; break;
+        case SC_DOT:   st = digit ? SC_FRAC : -1; break;
+        case SC_FRAC:  st = digit ? SC_FRAC : exp ? SC_E : -1; break;
+        case SC_E:     st = c == '+' || c == '-' ? SC_ESIGN : digit ? SC_EXP : -1; break;
+        case SC_ESIGN:
+        case SC_EXP:   st = digit ? SC_EXP : -1; break;
+        }
+
+        if (st < 0)
+                return -1;
+        js->scalar = st;
+
+        return 0;
+}
+
+static int scalar_done(const struct ndjson_state *js)
+{
+        switch (js->scalar) {
+        case SC_WORD:  return *js->word == '\0';
+        case SC_ZERO:
+        case SC_INT:
+        case SC_FRAC:
+        case SC_EXP:   return 1;
+        default:       return 0;
+        }
+}
+
+/* The open line ends, 'in_string' at its end. */
+static void end_line(struct ndjson_state *js, int in_string)
+{
+        if (js->filled) {
+                if (js->why == NJ_OK && in_string)
+                        js->why = NJ_STRING;
+                else if (js->why == NJ_OK && js->depth)
+                        js->why = NJ_TRUNCATED;
+                else if (js->why == NJ_OK && js->scalar >= SC_WORD && !scalar_done(js))
+                        js->why = NJ_VALUE;
+
+                js->records++;
+                if (js->why != NJ_OK) {
+                        add_bad(js, js->lines + 1, js->why);
+                        __atomic_store_n(&seen_malformed, 1, __ATOMIC_RELAXED);
+                }
+        }
+
+        line_reset(js);
+}
+
+static void bracket(struct ndjson_state *js, unsigned char c)
+{
+        uint64_t brace = c == '{' || c == '}';
+
+        if (js->why != NJ_OK)
+                return;
+
+        if (c == '{' || c == '[') {
+                if (js->depth == NDJSON_DEPTH) {
+                        js->why = NJ_DEEP;
+                } else {
+                        uint64_t *w = &js->open[js->depth / 64];
+                        *w = (*w & ~(1ULL << (js->depth % 64))) | brace << (js->depth % 64);
+                        js->depth++;
+                }
+                return;
+        }
+
+        if (!js->depth || (js->open[(js->depth - 1) / 64] >> ((js->depth - 1) % 64) & 1) != brace) {
+                js->why = NJ_UNBALANCED;
+                return;
+        }
+
+        if (--js->depth == 0)
+                js->values++;
+}
+
+/* Once the top-level value ended only whitespace may follow. */
+static void trailing(struct ndjson_state *js, const char *buf, unsigned from, unsigned to)
+{
+        for (unsigned i = from; i < to && js->why == NJ_OK; i++) {
+                if (!is_ws((unsigned char) buf[i]))
+                        js->why = NJ_TRAILING;
+        }
+}
+
+/* bit i of the result is the XOR of bits 0..i of 'x' */
+static inline uint64_t prefix_xor(uint64_t x)
+{
+        x ^= x << 1;
+        x ^= x << 2;
+        x ^= x << 4;
+        x ^= x << 8;
+        x ^= x << 16;
+        x ^= x << 32;
+
+        return x;
+}
+
+/* Bytes escaped by a backslash, the odd ones of each run. A run that
+ * starts on an even bit escapes its odd offsets, so the carry of an add
+ * at the start of the odd-bit runs flips the pattern. 'bs' has no bit at
+ * or past 'nbits', the carry out tells whether byte 'nbits' is escaped. */
+static inline uint64_t find_escaped(uint64_t bs, unsigned nbits, int *carry)
+{
+        const uint64_t even = 0x5555555555555555ULL;
+        uint64_t in = (uint64_t) *carry;
+
+        bs &= ~in;
+        uint64_t follows = bs << 1 | in;
+        uint64_t odd_starts = bs & ~even & ~follows;
+        uint64_t even_runs;
+        int over = __builtin_add_overflow(odd_starts, bs, &even_runs);
+        uint64_t escaped = (even ^ even_runs << 1) & follows;
+
+        if (nbits == 64) {
+                *carry = over;
+                return escaped;
+        }
+
+        *carry = (int) (escaped >> nbits & 1);
+        return escaped & ((1ULL << nbits) - 1);
+}
+
+/* One word of bitmaps for the 'nbits' bytes at 'buf'. */
+static void ndjson_block(struct ndjson_state *js, const uint64_t *text, const uint64_t *br,
+                         const char *buf, unsigned nbits)
+{
+        uint64_t quote = text[B_QUOTE] & ~find_escaped(text[B_BSLASH], nbits, &js->escaped);
+        uint64_t raw = prefix_xor(quote);
+        uint64_t brackets = br[0] | br[1] | br[2] | br[3];
+        uint64_t ends = text[B_NL];
+        uint64_t instr = 0;
+        unsigned from = 0;
+
+        for (;;) {
+                unsigned p = ends ? (unsigned) __builtin_ctzll(ends) : nbits;
+                uint64_t seg = (p == 64 ? ~0ULL : (1ULL << p) - 1) & ~((1ULL << from) - 1);
+                int flip = (from ? (int) (raw >> (from - 1) & 1) : 0) ^ js->in_string;
+
+                instr = raw ^ (flip ? ~0ULL : 0);
+
+                unsigned at = from;     /* bytes before are checked */
+
+                for (; at < p && !js->filled; at++) {
+                        if (!is_ws((unsigned char) buf[at]))
+                                value_start(js, (unsigned char) buf[at]);
+                }
+
+                /* a top-level string ends at its closing quote, numbers
+                 * and literals at whitespace */
+                if (js->why == NJ_OK && js->scalar == SC_STRING && at < p) {
+                        uint64_t out = ~instr & seg & ~((1ULL << at) - 1);
+                        at = out ? (unsigned) __builtin_ctzll(out) + 1 : p;
+                        if (out) {
+                                js->scalar = SC_NONE;
+                                js->values = 1;
+                        }
+                }
+                for (; js->why == NJ_OK && js->scalar >= SC_WORD && at < p; at++) {
+                        unsigned char c = (unsigned char) buf[at];
+                        if (!is_ws(c)) {
+                                if (scalar_step(js, c) != 0)
+                                        js->why = NJ_VALUE;
+                        } else {
+                                if (!scalar_done(js))
+                                        js->why = NJ_VALUE;
+                                js->scalar = SC_NONE;
+                                js->values = 1;
+                        }
+                }
+
+                /* brackets up to the first stray backslash */
+                uint64_t stray = text[B_BSLASH] & seg & ~instr;
+                uint64_t walk = brackets & seg & ~instr;
+                if (stray)
+                        walk &= (1ULL << __builtin_ctzll(stray)) - 1;
+
+                if (js->values) {
+                        trailing(js, buf, at, p);
+                } else if (js->scalar == SC_NONE) {
+                        for (; walk; walk &= walk - 1) {
+                                unsigned b = (unsigned) __builtin_ctzll(walk);
+                                bracket(js, (unsigned char) buf[b]);
+                                if (js->values) {
+                                        trailing(js, buf, b + 1, p);
+                                        break;
+                                }
+                        }
+                }
+
+                if (stray && js->why == NJ_OK)
+                        js->why = NJ_ESCAPE;
+
+                if (!ends)
+                        break;
+
+                end_line(js, (int) (instr >> p & 1));
+                js->lines++;
+                ends &= ends - 1;
+                from = p + 1;
+                if (from == nbits)
+                        return;
+        }
+
+        js->in_string = (int) (instr >> (nbits - 1) & 1);
+}
+
+void ndjson_feed(struct ndjson_state *js, const char *buf, size_t n)
+{
+        uint64_t text[4 * NDJSON_WORDS];
+        uint64_t br[4 * NDJSON_WORDS];
+
+        for (size_t off = 0; off < n; off += NDJSON_SLICE) {
+                size_t len = n - off < NDJSON_SLICE ? n - off : NDJSON_SLICE;
+
+                simd_find_bytes4(buf + off, len, text_bytes, text);
+                simd_find_bytes4(buf + off, len, bracket_bytes, br);
+
+                for (size_t i = 0; i < len; i += 64) {
+                        unsigned nbits = len - i < 64 ? (unsigned) (len - i) : 64;
+                        ndjson_block(js, text + 4 * (i / 64), br + 4 * (i / 64), buf + off + i, nbits);
+                }
+        }
+}
+
+void ndjson_merge(struct ndjson_state *dst, const struct ndjson_state *src)
+{
+        for (size_t i = 0; i < src->nbad && dst->nbad < NDJSON_REPORT; i++)
+                dst->bad[dst->nbad++] = (struct ndjson_bad) { dst->lines + src->bad[i].line, src->bad[i].why };
+
+        dst->records += src->records;
+        dst->malformed += src->malformed;
+        dst->lines += src->lines;
+
+        dst->why = src->why;
+        dst->filled = src->filled;
+        dst->values = src->values;
+        dst->in_string = src->in_string;
+        dst->scalar = src->scalar;
+        dst->word = src->word;
+        dst->escaped = src->escaped;
+        dst->depth = src->depth;
+        memcpy(dst->open, src->open, sizeof(dst->open));
+}
+
+void ndjson_finish(struct ndjson_state *js)
+{
+        end_line(js, js->in_string);
+}
@@ -0,0 +1,66 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * ndjson - count and check records of newline-delimited JSON
+ *
+ * Quotes, backslashes, newlines and brackets of 64 bytes at a time are
+ * turned into bitmaps by a vector kernel. Escaped quotes are dropped by
+ * carrying over runs of backslashes, a prefix XOR masks the strings, and
+ * only the brackets left outside them are walked, against a stack of the
+ * open ones. A record is one value, a line holding a top-level string,
+ * number or literal is checked byte by byte. Scalars inside containers,
+ * commas and colons are not checked, so this finds truncated, unbalanced
+ * and garbled records rather than every syntax error. A JSON string
+ * never spans lines, each line is a record on its own and a file splits
+ * in ranges of whole lines.
+ */
+#ifndef NDJSON_H_
+#define NDJSON_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NDJSON_DEPTH  1024              /* deeper records are malformed */
+#define NDJSON_REPORT 10                /* malformed lines kept per stream */
+
+struct ndjson_bad
+{
+        uint64_t line;                  /* 1-based */
+        int why;
+};
+
+struct ndjson_state
+{
+        uint64_t records;               /* lines not blank */
+        uint64_t malformed;
+        uint64_t lines;                 /* newlines fed */
+        size_t nbad;
+        struct ndjson_bad bad[NDJSON_REPORT];
+
+        /* the open line */
+        int why;                        /* its first error, 0 if none */
+        int filled;                     /* it is not blank so far */
+        int values;                     /* its top-level value ended */
+        int in_string;                  /* the last byte fed was in a string */
+        int scalar;                     /* state of a top-level scalar */
+        const char *word;               /* ... the rest of a literal */
+        int escaped;                    /* the next byte fed is escaped */
+        unsigned depth;
+        uint64_t open[NDJSON_DEPTH / 64]; /* 1 for '{', 0 for '[' */
+};
+
+void ndjson_reset(struct ndjson_state *js);
+void ndjson_feed(struct ndjson_state *js, const char *buf, size_t n);
+/* 'src' continues the stream of 'dst' after a newline. */
+void ndjson_merge(struct ndjson_state *dst, const struct ndjson_state *src);
+/* The stream has ended, check its last line. */
+void ndjson_finish(struct ndjson_state *js);
+
+/* What is wrong with a malformed line. */
+const char *ndjson_error(int why);
+
+/* Return non-zero once any malformed record was found. */
+int ndjson_seen_malformed(void);
+
+#endif /* NDJSON_H_ */
@@ -0,0 +1,149 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#include "pool.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+struct job
+{
+        pool_fn_t fn;
+        void *arg;
+        struct job *next;
+};
+
+struct pool
+{
+        pthread_mutex_t lock;
+        pthread_cond_t  ready;          /* a job was queued or the pool stops */
+        pthread_cond_t  idle;           /* the queue drained and nobody runs */
+        struct job     *head;
+        struct job     *tail;
+        int             running;        /* jobs being executed */
+        int             stop;
+        int             nthreads;
+        pthread_t      *threads;
+};
+
+static void *pool_worker(void *_arg)
+{
+        struct pool *p = _arg;
+        struct job *job;
+
+        pthread_mutex_lock(&p->lock);
+
+        for (;;) {
+                while (!p->head && !p->stop)
+                        pthread_cond_wait(&p->ready, &p->lock);
+
+                if (!p->head)
+                        break;
+
+                job = p->head;
+                p->head = job->next;
+                if (!p->head)
+                        p->tail = NULL;
+                p->running++;
+
+                pthread_mutex_unlock(&p->lock);
+                job->fn(job->arg);
+                free(job);
+                pthread_mutex_lock(&p->lock);
+
+                p->running--;
+                if (!p->head && p->running == 0)
+                        pthread_cond_broadcast(&p->idle);
+        }
+
+        pthread_mutex_unlock(&p->lock);
+
+        return NULL;
+}
+
+struct pool *pool_create(int nthreads)
+{
+        struct pool *p = calloc(1, sizeof(*p));
+        if (!p)
+                return NULL;
+
+        p->threads = calloc((size_t) nthreads, sizeof(pthread_t));
+        if (!p->threads) {
+                free(p);
+                return NULL;
+        }
+
+        pthread_mutex_init(&p->lock, NULL);
+        pthread_cond_init(&p->ready, NULL);
+        pthread_cond_init(&p->idle, NULL);
+
+        for (int i = 0; i < nthreads; i++) {
+                if (pthread_create(&p->threads[p->nthreads], NULL, pool_worker, p) != 0)
+                        break;
+                p->nthreads++;
+        }
+
+        if (p->nthreads == 0) {
+                pool_destroy(p);
+                return NULL;
+        }
+
+        return p;
+}
+
+int pool_submit(struct pool *p, pool_fn_t fn, void *arg)
+{
+        struct job *job = malloc(sizeof(*job));
+        if (!job)
+                return ENOMEM;
+
+        job->fn = fn;
+        job->arg = arg;
+        job->next = NULL;
+
+        pthread_mutex_lock(&p->lock);
+        if (p->tail)
+                p->tail->next = job;
+        else
+                p->head = job;
+        p->tail = job;
+        pthread_cond_signal(&p->ready);
+        pthread_mutex_unlock(&p->lock);
+
+        return 0;
+}
+
+void pool_wait(struct pool *p)
+{
+        pthread_mutex_lock(&p->lock);
+        while (p->head || p->running > 0)
+                pthread_cond_wait(&p->idle, &p->lock);
+        pthread_mutex_unlock(&p->lock);
+}
+
+void pool_destroy(struct pool *p)
+{
+        pthread_mutex_lock(&p->lock);
+        p->stop = 1;
+        pthread_cond_broadcast(&p->ready);
+        pthread_mutex_unlock(&p->lock);
+
+        for (int i = 0; i < p->nthreads; i++)
+                pthread_join(p->threads[i], NULL);
+
+        pthread_cond_destroy(&p->idle);
+        pthread_cond_destroy(&p->ready);
+        pthread_mutex_destroy(&p->lock);
+        free(p->threads);
+        free(p);
+}
+
+int pool_ncpu(void)
+{
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+        return n > 0 ? (int) n : 1;
+}
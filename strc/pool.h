@@ -0,0 +1,30 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * pool - fixed-size worker pool over a FIFO job queue
+ *
+ * Jobs run in submit order as workers become free; callers that want a
+ * particular schedule (e.g. largest file first) submit in that order.
+ */
+#ifndef POOL_H_
+#define POOL_H_
+
+typedef void (*pool_fn_t)(void *arg);
+
+struct pool;
+
+/* Start 'nthreads' workers, fewer when the system refuses to create
+ * more, return NULL when not a single worker could be started. */
+struct pool *pool_create(int nthreads);
+/* Queue a job, return 0 on success otherwise an errno value. */
+int pool_submit(struct pool *p, pool_fn_t fn, void *arg);
+/* Block until the queue is empty and every worker is idle. */
+void pool_wait(struct pool *p);
+/* Wait for pending jobs and join the workers. */
+void pool_destroy(struct pool *p);
+
+/* Number of online CPUs, at least 1. */
+int pool_ncpu(void);
+
+#endif /* POOL_H_ */
@@ -0,0 +1,888 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#include "simd.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <r9k/compiler_attrs.h>
+
+#include "util.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  define SIMD_X86 1
+#  include <immintrin.h>
+#  define __target(isa) __attribute__((target(isa)))
+#endif
+
+enum isa_level
+{
+        ISA_SCALAR = 0,
+        ISA_SSE2,
+        ISA_AVX2,
+        ISA_AVX512,
+};
+
+static const char *isa_names[] = { "scalar", "sse2", "avx2", "avx512" };
+
+struct simd_ops
+{
+        enum isa_level level;
+        size_t (*count_byte)(const char *buf, size_t n, unsigned char c);
+        size_t (*count_utf8)(const char *buf, size_t n);
+        void (*tally)(const char *buf, size_t n, struct simd_tally *t);
+        void (*lines)(const char *buf, size_t n, struct simd_lines *st);
+        void (*find_pair)(const char *buf, size_t n, size_t gap, unsigned char a, unsigned char b, uint64_t *bits);
+        size_t (*utf8_valid)(const char *buf, size_t n);
+        void (*find_bytes4)(const char *buf, size_t n, const unsigned char c[4], uint64_t *bits);
+};
+
+/* Scalar reference kernels, every vector kernel must agree with these. */
+static size_t count_byte_scalar(const char *buf, size_t n, unsigned char c)
+{
+        size_t count = 0;
+
+        for (size_t i = 0; i < n; i++)
+                count += (unsigned char) buf[i] == c;
+
+        return count;
+}
+
+/* A character is any byte that is not a continuation byte (10xxxxxx),
+ * so the count is additive and a sequence split across two buffers is
+ * still counted exactly once. */
+static size_t count_utf8_scalar(const char *buf, size_t n)
+{
+        size_t count = 0;
+
+        for (size_t i = 0; i < n; i++)
+                count += ((unsigned char) buf[i] & 0xC0) != 0x80;
+
+        return count;
+}
+
+static void tally_scalar(const char *buf, size_t n, struct simd_tally *t)
+{
+        for (size_t i = 0; i < n; i++) {
+                unsigned char c = (unsigned char) buf[i];
+                int ws = is_ws(c);
+
+                t->lines += c == '\n';
+                t->chars += (c & 0xC0) != 0x80;
+                t->words += !ws && !t->in_word;
+                t->in_word = !ws;
+        }
+}
+
+/* Fold the newline, continuation and whitespace bitmaps of one 64-byte
+ * block into the tally. A word starts at every non-space byte whose
+ * predecessor is a space, the predecessor of bit 0 comes from the
+ * previous block. */
+__attr_always_inline
+static inline void tally_block(struct simd_tally *t, uint64_t nl, uint64_t cont, uint64_t ws)
+{
+        uint64_t starts = ~ws & ((ws << 1) | (uint64_t) !t->in_word);
+
+        t->lines += (size_t) __builtin_popcountll(nl);
+        t->chars += 64 - (size_t) __builtin_popcountll(cont);
+        t->words += (size_t) __builtin_popcountll(starts);
+        t->in_word = !(ws >> 63);
+}
+
+__attr_always_inline
+static inline void line_add(struct simd_lines *st, uint64_t len)
+{
+        st->lines++;
+        st->total += len;
+        if (len < st->min)
+                st->min = len;
+        if (len > st->max)
+                st->max = len;
+        st->hist[len ? 64 - __builtin_clzll(len) : 0]++;
+}
+
+static void lines_scalar(const char *buf, size_t n, struct simd_lines *st)
+{
+        for (size_t i = 0; i < n; i++) {
+                if (buf[i] == '\n') {
+                        line_add(st, st->cur);
+                        st->cur = 0;
+                } else {
+                        st->cur++;
+                }
+        }
+}
+
+/* Walk the set bits of the newline bitmap of the block at 'base', a line
+ * ends at each of them. '*start' is where the open line began in this
+ * buffer, its earlier part is in st->cur. */
+__attr_always_inline
+static inline void lines_block(struct simd_lines *st, uint64_t nl, size_t base, size_t *start)
+{
+        while (nl) {
+                size_t pos = base + (size_t) __builtin_ctzll(nl);
+
+                line_add(st, st->cur + (pos - *start));
+                st->cur = 0;
+                *start = pos + 1;
+                nl &= nl - 1;
+        }
+}
+
+static void find_pair_scalar(const char *buf, size_t n, size_t gap, unsigned char a, unsigned char b, uint64_t *bits)
+{
+        for (size_t i = 0; i + gap < n; i++) {
+                if (i % 64 == 0)
+                        bits[i / 64] = 0;
+                if ((unsigned char) buf[i] == a && (unsigned char) buf[i + gap] == b)
+                        bits[i / 64] |= 1ULL << (i % 64);
+        }
+}
+
+/* The start of the character holding buf[i - 1] when it is incomplete,
+ * else 'i'. buf[0, i) is known valid apart from its last character. */
+static size_t utf8_boundary(const char *buf, size_t i)
+{
+        size_t p = i;
+
+        while (p > 0 && i - p < 3 && ((unsigned char) buf[p - 1] & 0xC0) == 0x80)
+                p--;
+        if (p > 0 && (unsigned char) buf[p - 1] >= 0xC0)
+                p--;
+
+        return p;
+}
+
+/* Only skips ASCII, the caller validates the rest byte by byte. */
+static size_t utf8_valid_scalar(const char *buf, size_t n)
+{
+        size_t i = 0;
+
+        for (; n - i >= 8; i += 8) {
+                uint64_t w;
+                memcpy(&w, buf + i, sizeof(w));
+                if (w & 0x8080808080808080ULL)
+                        break;
+        }
+
+        return i;
+}
+
+static void find_bytes4_scalar(const char *buf, size_t n, const unsigned char c[4], uint64_t *bits)
+{
+        for (size_t i = 0; i < n; i++) {
+                uint64_t *w = bits + 4 * (i / 64);
+                unsigned char b = (unsigned char) buf[i];
+
+                if (i % 64 == 0)
+                        w[0] = w[1] = w[2] = w[3] = 0;
+                for (int k = 0; k < 4; k++)
+                        w[k] |= (uint64_t) (b == c[k]) << (i % 64);
+        }
+}
+
+#ifdef SIMD_X86
+__target("sse2")
+static size_t count_byte_sse2(const char *buf, size_t n, unsigned char c)
+{
+        const __m128i needle = _mm_set1_epi8((char) c);
+        const __m128i zero = _mm_setzero_si128();
+        __m128i total = zero;
+        size_t i = 0;
+
+        while (n - i >= 16) {
+                /* 8-bit lanes overflow after 255 matches */
+                size_t iter = (n - i) / 16;
+                if (iter > 255)
+                        iter = 255;
+
+                __m128i acc = zero;
+                for (size_t k = 0; k < iter; k++, i += 16) {
+                        __m128i v = _mm_loadu_si128((const __m128i *) (buf + i));
+                        acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, needle));
+                }
+                total = _mm_add_epi64(total, _mm_sad_epu8(acc, zero));
+        }
+
+        size_t count = (size_t) _mm_cvtsi128_si64(total)
+                       + (size_t) _mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total));
+
+        return count + count_byte_scalar(buf + i, n - i, c);
+}
+
+/* Continuation bytes 0x80..0xBF are exactly the signed bytes below -64. */
+__target("sse2")
+static size_t count_utf8_sse2(const char *buf, size_t n)
+{
+        const __m128i bound = _mm_set1_epi8(-64);
+        const __m128i zero = _mm_setzero_si128();
+        __m128i total = zero;
+        size_t i = 0;
+
+        while (n - i >= 16) {
+                size_t iter = (n - i) / 16;
+                if (iter > 255)
+                        iter = 255;
+
+                __m128i acc = zero;
+                for (size_t k = 0; k < iter; k++, i += 16) {
+                        __m128i v = _mm_loadu_si128((const __m128i *) (buf + i));
+                        acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(bound, v));
+                }
+                total = _mm_add_epi64(total, _mm_sad_epu8(acc, zero));
+        }
+
+        size_t cont = (size_t) _mm_cvtsi128_si64(total)
+                      + (size_t) _mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total));
+
+        return (i - cont) + count_utf8_scalar(buf + i, n - i);
+}
+
+__target("sse2")
+static void tally_sse2(const char *buf, size_t n, struct simd_tally *t)
+{
+        const __m128i nl = _mm_set1_epi8('\n');
+        const __m128i sp = _mm_set1_epi8(' ');
+        const __m128i tab = _mm_set1_epi8('\t');
+        const __m128i span = _mm_set1_epi8('\r' - '\t');
+        const __m128i bound = _mm_set1_epi8(-64);
+        size_t i = 0;
+
+        for (; n - i >= 64; i += 64) {
+                uint64_t m_nl = 0, m_cont = 0, m_ws = 0;
+
+                for (int k = 0; k < 4; k++) {
+                        __m128i v = _mm_loadu_si128((const __m128i *) (buf + i + 16 * k));
+                        __m128i d = _mm_sub_epi8(v, tab);
+                        __m128i ws = _mm_or_si128(_mm_cmpeq_epi8(v, sp),
+                                                  _mm_cmpeq_epi8(_mm_min_epu8(d, span), d));
+
+                        m_nl |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (16 * k);
+                        m_cont |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpgt_epi8(bound, v)) << (16 * k);
+                        m_ws |= (uint64_t) (uint16_t) _mm_movemask_epi8(ws) << (16 * k);
+                }
+
+                tally_block(t, m_nl, m_cont, m_ws);
+        }
+
+        tally_scalar(buf + i, n - i, t);
+}
+
+__target("sse2")
+static void lines_sse2(const char *buf, size_t n, struct simd_lines *st)
+{
+        const __m128i nl = _mm_set1_epi8('\n');
+        size_t start = 0;
+        size_t i = 0;
+
+        for (; n - i >= 64; i += 64) {
+                uint64_t m_nl = 0;
+
+                for (int k = 0; k < 4; k++) {
+                        __m128i v = _mm_loadu_si128((const __m128i *) (buf + i + 16 * k));
+                        m_nl |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (16 * k);
+                }
+
+                lines_block(st, m_nl, i, &start);
+        }
+
+        st->cur += i - start;
+        lines_scalar(buf + i, n - i, st);
+}
+
+/* Compare the candidate start and end bytes of 64 positions at once, only
+ * the survivors need a full compare. */
+__target("sse2")
+static void find_pair_sse2(const char *buf, size_t n, size_t gap, unsigned char a, unsigned char b, uint64_t *bits)
+{
+        const __m128i va = _mm_set1_epi8((char) a);
+        const __m128i vb = _mm_set1_epi8((char) b);
+        size_t i = 0;
+
+        for (; i + gap + 64 <= n; i += 64) {
+                uint64_t m = 0;
+
+                for (int k = 0; k < 4; k++) {
+                        __m128i x = _mm_loadu_si128((const __m128i *) (buf + i + 16 * k));
+                        __m128i y = _mm_loadu_si128((const __m128i *) (buf + i + gap + 16 * k));
+                        __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(y, vb));
+                        m |= (uint64_t) (uint16_t) _mm_movemask_epi8(eq) << (16 * k);
+                }
+
+                bits[i / 64] = m;
+        }
+
+        if (i + gap < n)
+                find_pair_scalar(buf + i, n - i, gap, a, b, bits + i / 64);
+}
+
+__target("sse2")
+static size_t utf8_valid_sse2(const char *buf, size_t n)
+{
+        size_t i = 0;
+
+        for (; n - i >= 16; i += 16) {
+                if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (buf + i))))
+                        break;
+        }
+
+        return i;
+}
+
+__target("sse2")
+static void find_bytes4_sse2(const char *buf, size_t n, const unsigned char c[4], uint64_t *bits)
+{
+        const __m128i v0 = _mm_set1_epi8((char) c[0]);
+        const __m128i v1 = _mm_set1_epi8((char) c[1]);
+        const __m128i v2 = _mm_set1_epi8((char) c[2]);
+        const __m128i v3 = _mm_set1_epi8((char) c[3]);
+        size_t i = 0;
+
+        for (; n - i >= 64; i += 64) {
+                uint64_t *w = bits + 4 * (i / 64);
+
+                w[0] = w[1] = w[2] = w[3] = 0;
+                for (int k = 0; k < 4; k++) {
+                        __m128i v = _mm_loadu_si128((const __m128i *) (buf + i + 16 * k));
+                        w[0] |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, v0)) << (16 * k);
+                        w[1] |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, v1)) << (16 * k);
+                        w[2] |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, v2)) << (16 * k);
+                        w[3] |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, v3)) << (16 * k);
+                }
+        }
+
+        find_bytes4_scalar(buf + i, n - i, c, bits + 4 * (i / 64));
+}
+
+__target("avx2")
+static size_t count_byte_avx2(const char *buf, size_t n, unsigned char c)
+{
+        const __m256i needle = _mm256_set1_epi8((char) c);
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i total = zero;
+        size_t i = 0;
+
+        while (n - i >= 64) {
+                size_t iter = (n - i) / 64;
+                if (iter > 255)
+                        iter = 255;
+
+                __m256i acc0 = zero;
+                __m256i acc1 = zero;
+                for (size_t k = 0; k < iter; k++, i += 64) {
+                        __m256i v0 = _mm256_loadu_si256((const __m256i *) (buf + i));
+                        __m256i v1 = _mm256_loadu_si256((const __m256i *) (buf + i + 32));
+                        acc0 = _mm256_sub_epi8(acc0, _mm256_cmpeq_epi8(v0, needle));
+                        acc1 = _mm256_sub_epi8(acc1, _mm256_cmpeq_epi8(v1, needle));
+                }
+                total = _mm256_add_epi64(total, _mm256_sad_epu8(acc0, zero));
+                total = _mm256_add_epi64(total, _mm256_sad_epu8(acc1, zero));
+        }
+
+        size_t count = (size_t) _mm256_extract_epi64(total, 0)
+                       + (size_t) _mm256_extract_epi64(total, 1)
+                       + (size_t) _mm256_extract_epi64(total, 2)
+                       + (size_t) _mm256_extract_epi64(total, 3);
+
+        return count + count_byte_sse2(buf + i, n - i, c);
+}
+
+__target("avx2")
+static size_t count_utf8_avx2(const char *buf, size_t n)
+{
+        const __m256i bound = _mm256_set1_epi8(-64);
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i total = zero;
+        size_t i = 0;
+
+        while (n - i >= 64) {
+                size_t iter = (n - i) / 64;
+                if (iter > 255)
+                        iter = 255;
+
+                __m256i acc0 = zero;
+                __m256i acc1 = zero;
+                for (size_t k = 0; k < iter; k++, i += 64) {
+                        __m256i v0 = _mm256_loadu_si256((const __m256i *) (buf + i));
+                        __m256i v1 = _mm256_loadu_si256((const __m256i *) (buf + i + 32));
+                        acc0 = _mm256_sub_epi8(acc0, _mm256_cmpgt_epi8(bound, v0));
+                        acc1 = _mm256_sub_epi8(acc1, _mm256_cmpgt_epi8(bound, v1));
+                }
+                total = _mm256_add_epi64(total, _mm256_sad_epu8(acc0, zero));
+                total = _mm256_add_epi64(total, _mm256_sad_epu8(acc1, zero));
+        }
+
+        size_t cont = (size_t) _mm256_extract_epi64(total, 0)
+                      + (size_t) _mm256_extract_epi64(total, 1)
+                      + (size_t) _mm256_extract_epi64(total, 2)
+                      + (size_t) _mm256_extract_epi64(total, 3);
+
+        return (i - cont) + count_utf8_sse2(buf + i, n - i);
+}
+
+__target("avx2,popcnt")
+static void tally_avx2(const char *buf, size_t n, struct simd_tally *t)
+{
+        const __m256i nl = _mm256_set1_epi8('\n');
+        const __m256i sp = _mm256_set1_epi8(' ');
+        const __m256i tab = _mm256_set1_epi8('\t');
+        const __m256i span = _mm256_set1_epi8('\r' - '\t');
+        const __m256i bound = _mm256_set1_epi8(-64);
+        size_t i = 0;
+
+        for (; n - i >= 64; i += 64) {
+                uint64_t m_nl = 0, m_cont = 0, m_ws = 0;
+
+                for (int k = 0; k < 2; k++) {
+                        __m256i v = _mm256_loadu_si256((const __m256i *) (buf + i + 32 * k));
+                        __m256i d = _mm256_sub_epi8(v, tab);
+                        __m256i ws = _mm256_or_si256(_mm256_cmpeq_epi8(v, sp),
+                                                     _mm256_cmpeq_epi8(_mm256_min_epu8(d, span), d));
+
+                        m_nl |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)) << (32 * k);
+                        m_cont |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpgt_epi8(bound, v)) << (32 * k);
+                        m_ws |= (uint64_t) (uint32_t) _mm256_movemask_epi8(ws) << (32 * k);
+                }
+
+                tally_block(t, m_nl, m_cont, m_ws);
+        }
+
+        tally_scalar(buf + i, n - i, t);
+}
+
+__target("avx2")
+static void lines_avx2(const char *buf, size_t n, struct simd_lines *st)
+{
+        const __m256i nl = _mm256_set1_epi8('\n');
+        size_t start = 0;
+        size_t i = 0;
+
+        for (; n - i >= 64; i += 64) {
+                __m256i v0 = _mm256_loadu_si256((const __m256i *) (buf + i));
+                __m256i v1 = _mm256_loadu_si256((const __m256i *) (buf + i + 32));
+                uint64_t m_nl = (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, nl))
+                                | (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, nl)) << 32;
+
+                lines_block(st, m_nl, i, &start);
+        }
+
+        st->cur += i - start;
+        lines_scalar(buf + i, n - i, st);
+}
+
+__target("avx2")
+static void find_pair_avx2(const char *buf, size_t n, size_t gap, unsigned char a, unsigned char b, uint64_t *bits)
+{
+        const __m256i va = _mm256_set1_epi8((char) a);
+        const __m256i vb = _mm256_set1_epi8((char) b);
+        size_t i = 0;
+
+        for (; i + gap + 64 <= n; i += 64) {
+                uint64_t m = 0;
+
+                for (int k = 0; k < 2; k++) {
+                        __m256i x = _mm256_loadu_si256((const __m256i *) (buf + i + 32 * k));
+                        __m256i y = _mm256_loadu_si256((const __m256i *) (buf + i + gap + 32 * k));
+                        __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(y, vb));
+                        m |= (uint64_t) (uint32_t) _mm256_movemask_epi8(eq) << (32 * k);
+                }
+
+                bits[i / 64] = m;
+        }
+
+        if (i + gap < n)
+                find_pair_scalar(buf + i, n - i, gap, a, b, bits + i / 64);
+}
+
+/* Lookup tables of the UTF-8 validation by Keiser and Lemire, indexed by
+ * the high and low nibble of a byte and the high nibble of its successor.
+ * A pair of bytes is invalid when the three entries share a bit. */
+#define UTF8_TOO_SHORT  (1 << 0)        /* lead or ASCII, then lead or ASCII */
+#define UTF8_TOO_LONG   (1 << 1)        /* ASCII, then continuation */
+#define UTF8_OVERLONG_3 (1 << 2)
+#define UTF8_TOO_LARGE  (1 << 3)        /* above U+10FFFF */
+#define UTF8_SURROGATE  (1 << 4)
+#define UTF8_OVERLONG_2 (1 << 5)
+#define UTF8_TOO_LARGE_1000 (1 << 6)
+#define UTF8_OVERLONG_4 (1 << 6)
+#define UTF8_TWO_CONTS  (1 << 7)        /* continuation, then continuation */
+#define UTF8_CARRY      (UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS)
+
+static const uint8_t utf8_byte1_high[16] = {
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+};
+
+static const uint8_t utf8_byte1_low[16] = {
+        UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4,
+        UTF8_CARRY | UTF8_OVERLONG_2,
+        UTF8_CARRY,
+        UTF8_CARRY,
+        UTF8_CARRY | UTF8_TOO_LARGE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+        UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000,
+};
+
+static const uint8_t utf8_byte2_high[16] = {
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+};
+
+/* a lead byte in the last three needs bytes of the next vector */
+static const uint8_t utf8_incomplete[64] = {
+        [0 ... 60] = 0xFF, [61] = 0xF0 - 1, [62] = 0xE0 - 1, [63] = 0xC0 - 1,
+};
+
+/* Non-zero lanes where 'in' breaks UTF-8, 'prev' is the vector before. */
+__attr_always_inline __target("avx2")
+static inline __m256i utf8_check_avx2(__m256i in, __m256i prev)
+{
+        const __m256i nib = _mm256_set1_epi8(0x0F);
+        const __m256i t1h = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) utf8_byte1_high));
+        const __m256i t1l = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) utf8_byte1_low));
+        const __m256i t2h = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) utf8_byte2_high));
+        __m256i shifted = _mm256_permute2x128_si256(prev, in, 0x21);
+        __m256i prev1 = _mm256_alignr_epi8(in, shifted, 15);
+        __m256i prev2 = _mm256_alignr_epi8(in, shifted, 14);
+        __m256i prev3 = _mm256_alignr_epi8(in, shifted, 13);
+
+        __m256i sc = _mm256_and_si256(
+                _mm256_and_si256(_mm256_shuffle_epi8(t1h, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nib)),
+                                 _mm256_shuffle_epi8(t1l, _mm256_and_si256(prev1, nib))),
+                _mm256_shuffle_epi8(t2h, _mm256_and_si256(_mm256_srli_epi16(in, 4), nib)));
+
+        /* the third and fourth byte of a sequence must be continuations */
+        __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char) (0xE0 - 0x80)));
+        __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char) (0xF0 - 0x80)));
+        __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char) 0x80));
+
+        return _mm256_xor_si256(must23, sc);
+}
+
+/* Stops at the first 64-byte block with an error, or one that is ASCII
+ * after an unfinished sequence, and leaves it to the caller. */
+__target("avx2")
+static size_t utf8_valid_avx2(const char *buf, size_t n)
+{
+        const __m256i incomplete = _mm256_loadu_si256((const __m256i *) (utf8_incomplete + 32));
+        __m256i prev = _mm256_setzero_si256();
+        size_t i = 0;
+
+        for (; n - i >= 64; i += 64) {
+                __m256i v0 = _mm256_loadu_si256((const __m256i *) (buf + i));
+                __m256i v1 = _mm256_loadu_si256((const __m256i *) (buf + i + 32));
+                __m256i err;
+
+                if (!_mm256_movemask_epi8(_mm256_or_si256(v0, v1)))
+                        err = _mm256_subs_epu8(prev, incomplete);
+                else
+                        err = _mm256_or_si256(utf8_check_avx2(v0, prev), utf8_check_avx2(v1, v0));
+
+                if (!_mm256_testz_si256(err, err))
+                        break;
+                prev = v1;
+        }
+
+        return utf8_boundary(buf, i);
+}
+
+__attr_always_inline __target("avx2")
+static inline uint64_t eq_mask_avx2(__m256i lo, __m256i hi, __m256i v)
+{
+        return (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, v))
+               | (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, v)) << 32;
+}
+
+__target("avx2")
+static void find_bytes4_avx2(const char *buf, size_t n, const unsigned char c[4], uint64_t *bits)
+{
+        const __m256i v0 = _mm256_set1_epi8((char) c[0]);
+        const __m256i v1 = _mm256_set1_epi8((char) c[1]);
+        const __m256i v2 = _mm256_set1_epi8((char) c[2]);
+        const __m256i v3 = _mm256_set1_epi8((char) c[3]);
+        size_t i = 0;
+
+        for (; n - i >= 64; i += 64) {
+                __m256i lo = _mm256_loadu_si256((const __m256i *) (buf + i));
+                __m256i hi = _mm256_loadu_si256((const __m256i *) (buf + i + 32));
+                uint64_t *w = bits + 4 * (i / 64);
+
+                w[0] = eq_mask_avx2(lo, hi, v0);
+                w[1] = eq_mask_avx2(lo, hi, v1);
+                w[2] = eq_mask_avx2(lo, hi, v2);
+                w[3] = eq_mask_avx2(lo, hi, v3);
+        }
+
+        find_bytes4_scalar(buf + i, n - i, c, bits + 4 * (i / 64));
+}
+
+__target("avx512f,avx512bw,popcnt")
+static size_t count_byte_avx512(const char *buf, size_t n, unsigned char c)
+{
+        const __m512i needle = _mm512_set1_epi8((char) c);
+        size_t count = 0;
+        size_t i = 0;
+
+        for (; n - i >= 64; i += 64) {
+                __m512i v = _mm512_loadu_si512((const void *) (buf + i));
+                count += (size_t) __builtin_popcountll(_mm512_cmpeq_epi8_mask(v, needle));
+        }
+
+        if (i < n) {
+                __mmask64 tail = ~0ULL >> (64 - (n - i));
+                __m512i v = _mm512_maskz_loadu_epi8(tail, buf + i);
+                count += (size_t) __builtin_popcountll(_mm512_mask_cmpeq_epi8_mask(tail, v, needle));
+        }
+
+        return count;
+}
+
+__target("avx512f,avx512bw,popcnt")
+static size_t count_utf8_avx512(const char *buf, size_t n)
+{
+        const __m512i bound = _mm512_set1_epi8(-64);
+        size_t cont = 0;
+        size_t i = 0;
+
+        for (; n - i >= 64; i += 64) {
+                __m512i v = _mm512_loadu_si512((const void *) (buf + i));
+                cont += (size_t) __builtin_popcountll(_mm512_cmplt_epi8_mask(v, bound));
+        }
+
+        if (i < n) {
+                __mmask64 tail = ~0ULL >> (64 - (n - i));
+                __m512i v = _mm512_maskz_loadu_epi8(tail, buf + i);
+                cont += (size_t) __builtin_popcountll(_mm512_mask_cmplt_epi8_mask(tail, v, bound));
+        }
+
+        return n - cont;
+}
+
+__target("avx512f,avx512bw,popcnt")
+static void tally_avx512(const char *buf, size_t n, struct simd_tally *t)
+{
+        const __m512i nl = _mm512_set1_epi8('\n');
+        const __m512i sp = _mm512_set1_epi8(' ');
+        const __m512i tab = _mm512_set1_epi8('\t');
+        const __m512i span = _mm512_set1_epi8('\r' - '\t');
+        const __m512i bound = _mm512_set1_epi8(-64);
+        size_t i = 0;
+
+        for (; n - i >= 64; i += 64) {
+                __m512i v = _mm512_loadu_si512((const void *) (buf + i));
+                uint64_t m_ws = _mm512_cmpeq_epi8_mask(v, sp)
+                                | _mm512_cmple_epu8_mask(_mm512_sub_epi8(v, tab), span);
+
+                tally_block(t, _mm512_cmpeq_epi8_mask(v, nl), _mm512_cmplt_epi8_mask(v, bound), m_ws);
+        }
+
+        tally_scalar(buf + i, n - i, t);
+}
+
+__target("avx512f,avx512bw")
+static void lines_avx512(const char *buf, size_t n, struct simd_lines *st)
+{
+        const __m512i nl = _mm512_set1_epi8('\n');
+        size_t start = 0;
+        size_t i = 0;
+
+        for (; n - i >= 64; i += 64) {
+                __m512i v = _mm512_loadu_si512((const void *) (buf + i));
+                lines_block(st, _mm512_cmpeq_epi8_mask(v, nl), i, &start);
+        }
+
+        st->cur += i - start;
+        lines_scalar(buf + i, n - i, st);
+}
+
+__target("avx512f,avx512bw")
+static void find_pair_avx512(const char *buf, size_t n, size_t gap, unsigned char a, unsigned char b, uint64_t *bits)
+{
+        const __m512i va = _mm512_set1_epi8((char) a);
+        const __m512i vb = _mm512_set1_epi8((char) b);
+        size_t i = 0;
+
+        for (; i + gap + 64 <= n; i += 64) {
+                __m512i x = _mm512_loadu_si512((const void *) (buf + i));
+                __m512i y = _mm512_loadu_si512((const void *) (buf + i + gap));
+                bits[i / 64] = _mm512_mask_cmpeq_epi8_mask(_mm512_cmpeq_epi8_mask(x, va), y, vb);
+        }
+
+        if (i + gap < n)
+                find_pair_scalar(buf + i, n - i, gap, a, b, bits + i / 64);
+}
+
+__attr_always_inline __target("avx512f,avx512bw")
+static inline __m512i utf8_check_avx512(__m512i in, __m512i prev)
+{
+        const __m512i nib = _mm512_set1_epi8(0x0F);
+        const __m512i t1h = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) utf8_byte1_high));
+        const __m512i t1l = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) utf8_byte1_low));
+        const __m512i t2h = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) utf8_byte2_high));
+        /* 'in' moved up one 16-byte lane, the last lane of 'prev' below */
+        __m512i shifted = _mm512_alignr_epi64(in, prev, 6);
+        __m512i prev1 = _mm512_alignr_epi8(in, shifted, 15);
+        __m512i prev2 = _mm512_alignr_epi8(in, shifted, 14);
+        __m512i prev3 = _mm512_alignr_epi8(in, shifted, 13);
+
+        __m512i sc = _mm512_and_si512(
+                _mm512_and_si512(_mm512_shuffle_epi8(t1h, _mm512_and_si512(_mm512_srli_epi16(prev1, 4), nib)),
+                                 _mm512_shuffle_epi8(t1l, _mm512_and_si512(prev1, nib))),
+                _mm512_shuffle_epi8(t2h, _mm512_and_si512(_mm512_srli_epi16(in, 4), nib)));
+
+        __m512i third = _mm512_subs_epu8(prev2, _mm512_set1_epi8((char) (0xE0 - 0x80)));
+        __m512i fourth = _mm512_subs_epu8(prev3, _mm512_set1_epi8((char) (0xF0 - 0x80)));
+        __m512i must23 = _mm512_and_si512(_mm512_or_si512(third, fourth), _mm512_set1_epi8((char) 0x80));
+
+        return _mm512_xor_si512(must23, sc);
+}
+
+__target("avx512f,avx512bw")
+static size_t utf8_valid_avx512(const char *buf, size_t n)
+{
+        const __m512i incomplete = _mm512_loadu_si512((const void *) utf8_incomplete);
+        __m512i prev = _mm512_setzero_si512();
+        size_t i = 0;
+
+        for (; n - i >= 64; i += 64) {
+                __m512i v = _mm512_loadu_si512((const void *) (buf + i));
+                __m512i err;
+
+                if (!_mm512_movepi8_mask(v))
+                        err = _mm512_subs_epu8(prev, incomplete);
+                else
+                        err = utf8_check_avx512(v, prev);
+
+                if (_mm512_test_epi8_mask(err, err))
+                        break;
+                prev = v;
+        }
+
+        return utf8_boundary(buf, i);
+}
+
+__target("avx512f,avx512bw")
+static void find_bytes4_avx512(const char *buf, size_t n, const unsigned char c[4], uint64_t *bits)
+{
+        const __m512i v0 = _mm512_set1_epi8((char) c[0]);
+        const __m512i v1 = _mm512_set1_epi8((char) c[1]);
+        const __m512i v2 = _mm512_set1_epi8((char) c[2]);
+        const __m512i v3 = _mm512_set1_epi8((char) c[3]);
+        size_t i = 0;
+
+        for (; n - i >= 64; i += 64) {
+                __m512i v = _mm512_loadu_si512((const void *) (buf + i));
+                uint64_t *w = bits + 4 * (i / 64);
+
+                w[0] = _mm512_cmpeq_epi8_mask(v, v0);
+                w[1] = _mm512_cmpeq_epi8_mask(v, v1);
+                w[2] = _mm512_cmpeq_epi8_mask(v, v2);
+                w[3] = _mm512_cmpeq_epi8_mask(v, v3);
+        }
+
+        find_bytes4_scalar(buf + i, n - i, c, bits + 4 * (i / 64));
+}
+#endif /* SIMD_X86 */
+
+static const struct simd_ops ops_table[] = {
+        [ISA_SCALAR] = { ISA_SCALAR, count_byte_scalar, count_utf8_scalar, tally_scalar, lines_scalar, find_pair_scalar, utf8_valid_scalar, find_bytes4_scalar },
+#ifdef SIMD_X86
+        [ISA_SSE2]   = { ISA_SSE2,   count_byte_sse2,   count_utf8_sse2,   tally_sse2,   lines_sse2,   find_pair_sse2,   utf8_valid_sse2,   find_bytes4_sse2 },
+        [ISA_AVX2]   = { ISA_AVX2,   count_byte_avx2,   count_utf8_avx2,   tally_avx2,   lines_avx2,   find_pair_avx2,   utf8_valid_avx2,   find_bytes4_avx2 },
+        [ISA_AVX512] = { ISA_AVX512, count_byte_avx512, count_utf8_avx512, tally_avx512, lines_avx512, find_pair_avx512, utf8_valid_avx512, find_bytes4_avx512 },
+#endif
+};
+
+static const struct simd_ops *ops = &ops_table[ISA_SCALAR];
+
+static enum isa_level cpu_level(void)
+{
+#ifdef SIMD_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw"))
+                return ISA_AVX512;
+        if (__builtin_cpu_supports("avx2"))
+                return ISA_AVX2;
+        return ISA_SSE2;
+#else
+        return ISA_SCALAR;
+#endif
+}
+
+void simd_init(void)
+{
+        enum isa_level level = cpu_level();
+        const char *force = getenv("STRC_SIMD");
+
+        if (force) {
+                for (int i = 0; i <= (int) level; i++) {
+                        if (strcmp(force, isa_names[i]) == 0) {
+                                level = (enum isa_level) i;
+                                break;
+                        }
+                }
+        }
+
+        ops = &ops_table[level];
+}
+
+size_t simd_count_byte(const char *buf, size_t n, unsigned char c)
+{
+        return ops->count_byte(buf, n, c);
+}
+
+size_t simd_count_utf8(const char *buf, size_t n)
+{
+        return ops->count_utf8(buf, n);
+}
+
+void simd_tally(const char *buf, size_t n, struct simd_tally *t)
+{
+        ops->tally(buf, n, t);
+}
+
+void simd_lines(const char *buf, size_t n, struct simd_lines *st)
+{
+        ops->lines(buf, n, st);
+}
+
+void simd_find_pair(const char *buf, size_t n, size_t gap, unsigned char a, unsigned char b, uint64_t *bits)
+{
+        ops->find_pair(buf, n, gap, a, b, bits);
+}
+
+size_t simd_utf8_valid(const char *buf, size_t n)
+{
+        return ops->utf8_valid(buf, n);
+}
+
+void simd_find_bytes4(const char *buf, size_t n, const unsigned char c[4], uint64_t *bits)
+{
+        ops->find_bytes4(buf, n, c, bits);
+}
+
+void simd_lines_add(struct simd_lines *st, uint64_t len)
+{
+        line_add(st, len);
+}
@@ -0,0 +1,73 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * simd - vectorized counting kernels for strc
+ *
+ * Every kernel has a scalar reference implementation and, on x86-64,
+ * SSE2/AVX2/AVX-512 variants. The best variant supported by the running
+ * CPU is selected once by simd_init(), the environment variable
+ * STRC_SIMD=scalar|sse2|avx2|avx512 can force a lower one.
+ */
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Running totals of the fused kernel. 'in_word' carries whether the last
+ * byte of the previous buffer was part of a word, so a word split across
+ * two buffers is counted once. */
+struct simd_tally
+{
+        size_t lines;
+        size_t chars;
+        size_t words;
+        int in_word;
+};
+
+/* Line length statistics. hist[0] counts empty lines and hist[k] the
+ * lines of length [2^(k-1), 2^k). 'cur' carries the length of the line
+ * still open at the end of the last buffer, 'min' starts at UINT64_MAX. */
+#define SIMD_LEN_BUCKETS 65
+
+struct simd_lines
+{
+        uint64_t lines;
+        uint64_t total;
+        uint64_t min;
+        uint64_t max;
+        uint64_t cur;
+        uint64_t hist[SIMD_LEN_BUCKETS];
+};
+
+/* Select kernels for the running CPU, must be called before any
+ * worker thread is created. */
+void simd_init(void);
+
+/* Count occurrences of byte 'c' in buf[0, n). */
+size_t simd_count_byte(const char *buf, size_t n, unsigned char c);
+/* Count UTF-8 characters in buf[0, n), embedded NUL bytes included. */
+size_t simd_count_utf8(const char *buf, size_t n);
+/* Add newlines, UTF-8 characters and words of buf[0, n) to 't' in a
+ * single pass. */
+void simd_tally(const char *buf, size_t n, struct simd_tally *t);
+/* Record the length of every line ending in buf[0, n) into 'st', newlines
+ * excluded. */
+void simd_lines(const char *buf, size_t n, struct simd_lines *st);
+/* Mark in 'bits' every start i < n - gap where buf[i] == a and
+ * buf[i + gap] == b. Words bits[0, (n - gap + 63) / 64) are overwritten. */
+void simd_find_pair(const char *buf, size_t n, size_t gap, unsigned char a, unsigned char b, uint64_t *bits);
+/* Return an offset p such that buf[0, p) is valid UTF-8 ending on a
+ * character boundary, buf[0] must start a character. Whatever follows p,
+ * anything from a few bytes to the rest of the buffer, is left unchecked
+ * for a byte by byte pass to finish. */
+size_t simd_utf8_valid(const char *buf, size_t n);
+/* Mark where buf[0, n) holds each of the bytes c[0..3]: bit i % 64 of
+ * bits[4 * (i / 64) + k] is set when buf[i] == c[k]. Bits past 'n' in the
+ * last words are clear. */
+void simd_find_bytes4(const char *buf, size_t n, const unsigned char c[4], uint64_t *bits);
+/* Record a line of 'len' bytes into 'st'. */
+void simd_lines_add(struct simd_lines *st, uint64_t len);
+
+#endif /* SIMD_H_ */
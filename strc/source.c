@@ -0,0 +1,386 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#define _GNU_SOURCE /* O_DIRECT */
+#include "source.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <r9k/compiler_attrs.h>
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+
+#define BUFSIZE 262144 /* 256kb */
+
+/* Files below this size are cheaper to read() than to map, it also keeps
+ * /proc and sysfs files (st_size 0 or one page) off the mmap path. */
+#define MMAP_MIN   BUFSIZE
+/* Map large files one window at a time to bound address space usage. */
+#define MMAP_WINDOW ((off_t) 1 << 30) /* 1gb */
+/* How far past a nominal split point to look for a newline. */
+#define SPLIT_SCAN  65536
+/* --no-cache reads big blocks, O_DIRECT needs them aligned */
+#define NOCACHE_BUF   ((size_t) 4 << 20) /* 4mb */
+#define NOCACHE_ALIGN 4096
+/* drop pages behind the cursor every this many bytes */
+#define NOCACHE_DROP  ((off_t) 16 << 20) /* 16mb */
+
+static int read_count(int fd, struct counter *ctr)
+{
+        char buf[BUFSIZE];
+        ssize_t n;
+
+        for (;;) {
+                n = read(fd, buf, BUFSIZE);
+                if (n == 0)
+                        return 0;
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return errno;
+                }
+                counter_feed(ctr, buf, (size_t) n);
+        }
+}
+
+static int pread_count(int fd, off_t off, off_t end, struct counter *ctr)
+{
+        char buf[BUFSIZE];
+        ssize_t n;
+
+        while (off < end) {
+                size_t want = (size_t) (end - off < BUFSIZE ? end - off : BUFSIZE);
+                n = pread(fd, buf, want, off);
+                if (n == 0)
+                        return 0;
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return errno;
+                }
+                counter_feed(ctr, buf, (size_t) n);
+                off += n;
+        }
+
+        return 0;
+}
+
+static int mmap_count(int fd, off_t off, off_t end, const struct source_opts *opts, struct counter *ctr)
+{
+        int flags = MAP_PRIVATE;
+
+#ifdef MAP_POPULATE
+        if (opts->populate)
+                flags |= MAP_POPULATE;
+#endif
+
+        /* mmap offsets must be page aligned */
+        off_t page = (off_t) sysconf(_SC_PAGESIZE);
+        off_t base = off - off % page;
+
+        while (base < end) {
+                size_t len = (size_t) (end - base < MMAP_WINDOW ? end - base : MMAP_WINDOW);
+                char *map = mmap(NULL, len, PROT_READ, flags, fd, base);
+                /* mapping refused by the filesystem, read the rest */
+                if (map == MAP_FAILED)
+                        return pread_count(fd, off, end, ctr);
+
+                madvise(map, len, MADV_SEQUENTIAL);
+
+                size_t skip = (size_t) (off - base);
+                counter_feed(ctr, map + skip, len - skip);
+
+                munmap(map, len);
+                base += (off_t) len;
+                off = base;
+        }
+
+        return 0;
+}
+
+static int is_direct(int fd)
+{
+#ifdef O_DIRECT
+        int fl = fcntl(fd, F_GETFL);
+        return fl >= 0 && (fl & O_DIRECT);
+#else
+        __attr_ignore(fd);
+        return 0;
+#endif
+}
+
+static void drop_cache(int fd, off_t off, off_t len)
+{
+#ifdef POSIX_FADV_DONTNEED
+        posix_fadvise(fd, off, len, POSIX_FADV_DONTNEED);
+#else
+        __attr_ignore2(fd, off);
+        __attr_ignore(len);
+#endif
+}
+
+/* Count [off, end) of a regular file (end < 0 for EOF) without leaving it
+ * in the page cache: O_DIRECT reads into an aligned buffer when the
+ * descriptor allows, otherwise plain reads that drop the pages behind. */
+static int nocache_count(int fd, off_t off, off_t end, struct counter *ctr)
+{
+        int direct = is_direct(fd);
+        off_t pos = direct ? off - off % NOCACHE_ALIGN : off;
+        off_t dropped = pos;
+        void *buf;
+        ssize_t n;
+        int err = 0;
+
+        if (posix_memalign(&buf, NOCACHE_ALIGN, NOCACHE_BUF) != 0)
+                return ENOMEM;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, off, end < 0 ? 0 : end - off, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        while (end < 0 || pos < end) {
+                n = pread(fd, buf, NOCACHE_BUF, pos);
+                if (n == 0)
+                        break;
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+#ifdef O_DIRECT
+                        /* the filesystem wants a different alignment */
+                        if (direct && errno == EINVAL) {
+                                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+                                direct = 0;
+                                continue;
+                        }
+#endif
+                        err = errno;
+                        break;
+                }
+
+                size_t from = off > pos ? (size_t) (off - pos) : 0;
+                size_t to = end >= 0 && pos + n > end ? (size_t) (end - pos) : (size_t) n;
+                if (to > from)
+                        counter_feed(ctr, (char *) buf + from, to - from);
+                pos += n;
+
+                if (!direct && pos - dropped >= NOCACHE_DROP) {
+                        drop_cache(fd, dropped, pos - dropped);
+                        dropped = pos;
+                }
+        }
+
+        if (!direct && pos > dropped)
+                drop_cache(fd, dropped, pos - dropped);
+
+        free(buf);
+
+        return err;
+}
+
+/* Count [off, end) of a regular file with whichever reader fits. */
+static int range_count(int fd, off_t off, off_t end, const struct source_opts *opts, struct counter *ctr)
+{
+        if (opts->no_cache)
+                return nocache_count(fd, off, end, ctr);
+
+        if (opts->no_mmap || end - off < MMAP_MIN)
+                return pread_count(fd, off, end, ctr);
+
+        return mmap_count(fd, off, end, opts, ctr);
+}
+
+/* Fewer blocks than the size needs, the file may have holes. */
+static int is_sparse(const struct stat *st)
+{
+        return S_ISREG(st->st_mode) && (off_t) st->st_blocks * 512 < st->st_size;
+}
+
+/* Count [off, end) of a sparse file, reading only its data extents. A
+ * hole reads as zeros, so it is accounted for without reading. */
+static int sparse_count(int fd, off_t off, off_t end, const struct source_opts *opts, struct counter *ctr)
+{
+#ifdef SEEK_DATA
+        while (off < end) {
+                off_t data = lseek(fd, off, SEEK_DATA);
+                if (data < 0) {
+                        /* no extents on this filesystem, read it all */
+                        if (errno != ENXIO)
+                                return range_count(fd, off, end, opts, ctr);
+                        /* a hole up to EOF */
+                        data = end;
+                }
+                if (data > end)
+                        data = end;
+
+                counter_zeros(ctr, (uint64_t) (data - off));
+                if (data == end)
+                        break;
+
+                off_t hole = lseek(fd, data, SEEK_HOLE);
+                if (hole < 0 || hole > end)
+                        hole = end;
+
+                int err = range_count(fd, data, hole, opts, ctr);
+                if (err != 0)
+                        return err;
+                off = hole;
+        }
+
+        return 0;
+#else
+        return range_count(fd, off, end, opts, ctr);
+#endif
+}
+
+/* Regular files on pseudo filesystems report a made up st_size. */
+static int size_trusted(int fd, const struct stat *st)
+{
+        if (!S_ISREG(st->st_mode) || st->st_size == 0)
+                return 0;
+
+#ifdef __linux__
+        struct statfs fs;
+        if (fstatfs(fd, &fs) == 0) {
+                switch (fs.f_type) {
+                case 0x9fa0:            /* PROC_SUPER_MAGIC */
+                case 0x62656572:        /* SYSFS_MAGIC */
+                case 0x64626720:        /* DEBUGFS_MAGIC */
+                case 0x74726163:        /* TRACEFS_MAGIC */
+                        return 0;
+                }
+        }
+#endif
+
+        return 1;
+}
+
+int source_count_fd(int fd, const struct source_opts *opts, struct counter *ctr)
+{
+        struct stat st;
+        off_t off;
+
+        if (fstat(fd, &st) != 0)
+                return errno;
+
+        /* the byte count of a regular file is its size */
+        if (!opts->force_read && counter_bytes_only(ctr) && size_trusted(fd, &st)) {
+                off = lseek(fd, 0, SEEK_CUR);
+                if (off >= 0 && off <= st.st_size) {
+                        ctr->n.bytes += (uint64_t) (st.st_size - off);
+                        return 0;
+                }
+        }
+
+        /* holes are skipped whatever the reader */
+        if (is_sparse(&st) && (off = lseek(fd, 0, SEEK_CUR)) >= 0)
+                return sparse_count(fd, off, st.st_size, opts, ctr);
+
+        if (!S_ISREG(st.st_mode) || (!opts->no_cache && (opts->no_mmap || st.st_size < MMAP_MIN)))
+                return read_count(fd, ctr);
+
+        off = lseek(fd, 0, SEEK_CUR);
+        if (off < 0)
+                return read_count(fd, ctr);
+
+        if (opts->no_cache)
+                return nocache_count(fd, off, -1, ctr);
+
+        return mmap_count(fd, off, st.st_size, opts, ctr);
+}
+
+int source_open(const char *path, const struct source_opts *opts)
+{
+        int fd;
+
+#ifdef O_DIRECT
+        /* tmpfs and friends refuse O_DIRECT, they get plain reads */
+        if (opts->no_cache) {
+                fd = open(path, O_RDONLY | O_DIRECT);
+                if (fd >= 0 || errno != EINVAL)
+                        return fd;
+        }
+#endif
+
+        fd = open(path, O_RDONLY);
+
+#ifdef F_NOCACHE
+        if (fd >= 0 && opts->no_cache)
+                fcntl(fd, F_NOCACHE, 1);
+#endif
+
+        return fd;
+}
+
+int source_count_path(const char *path, const struct source_opts *opts, struct counter *ctr)
+{
+        int fd = source_open(path, opts);
+        if (fd < 0)
+                return errno;
+
+        int err = source_count_fd(fd, opts, ctr);
+
+        close(fd);
+
+        return err;
+}
+
+int source_count_range(int fd, off_t off, off_t end, const struct source_opts *opts, struct counter *ctr)
+{
+        struct stat st;
+
+        if (fstat(fd, &st) == 0 && is_sparse(&st))
+                return sparse_count(fd, off, end, opts, ctr);
+
+        return range_count(fd, off, end, opts, ctr);
+}
+
+int source_split(int fd, off_t off, off_t end, int prev, int n, int aligned, struct source_range *out)
+{
+        char buf[SPLIT_SCAN];
+        off_t page = (off_t) sysconf(_SC_PAGESIZE);
+        int k = 0;
+
+        out[0].off = off;
+        out[0].prev = prev;
+
+        for (int i = 1; i < n; i++) {
+                off_t cut = off + (end - off) / n * i;
+                cut -= cut % page;
+                if (cut <= out[k].off)
+                        continue;
+
+                /* read from the byte before the nominal cut, so 'prev' is
+                 * known even when no newline is close */
+                ssize_t r = pread(fd, buf, SPLIT_SCAN, cut - 1);
+                if (r <= 0)
+                        break;
+
+                prev = (unsigned char) buf[0];
+                char *nl = memchr(buf, '\n', (size_t) r);
+                if (nl) {
+                        cut += nl - buf;
+                        prev = '\n';
+                } else if (aligned) {
+                        continue;
+                }
+
+                if (cut >= end)
+                        break;
+
+                out[k].end = cut;
+                k++;
+                out[k].off = cut;
+                out[k].prev = prev;
+        }
+
+        out[k].end = end;
+
+        return k + 1;
+}
@@ -0,0 +1,59 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * source - feed file contents into a counter
+ *
+ * Large regular files are mapped and counted straight from the page cache,
+ * everything else (pipes, FIFOs, terminals, /proc and sysfs files whose
+ * st_size is not the real length) is read with read(). When only bytes
+ * are counted, a trustworthy st_size answers without reading at all.
+ * With 'no_cache' regular files are streamed with O_DIRECT, or read and
+ * dropped from the page cache behind the cursor, so huge cold inputs
+ * don't evict anybody else's cache. Files with fewer blocks than their
+ * size are walked with SEEK_DATA and SEEK_HOLE: only data extents are
+ * read, holes are counted as the zeros they read as.
+ */
+#ifndef SOURCE_H_
+#define SOURCE_H_
+
+#include <sys/types.h>
+
+#include "counter.h"
+
+struct source_opts
+{
+        int no_mmap;                    /* always use read() */
+        int populate;                   /* prefault mappings with MAP_POPULATE */
+        int force_read;                 /* count bytes even when st_size would do */
+        int no_cache;                   /* keep counted files out of the page cache */
+};
+
+/* A byte range [off, end) of a file, 'prev' is the byte right before
+ * 'off' or -1 at the start of the file. */
+struct source_range
+{
+        off_t off;
+        off_t end;
+        int prev;
+};
+
+/* Open 'path' for counting, with O_DIRECT under 'no_cache' when the
+ * filesystem allows. Return -1 on failure with errno set. */
+int source_open(const char *path, const struct source_opts *opts);
+
+/* Count from the current offset of 'fd' to EOF.
+ * Return 0 on success otherwise an errno value. */
+int source_count_fd(int fd, const struct source_opts *opts, struct counter *ctr);
+int source_count_path(const char *path, const struct source_opts *opts, struct counter *ctr);
+/* Count bytes [off, end) of 'fd', stop early at EOF. */
+int source_count_range(int fd, off_t off, off_t end, const struct source_opts *opts, struct counter *ctr);
+
+/* Split [off, end) of a regular file, whose byte before 'off' is 'prev',
+ * into at most 'n' ranges stored in 'out'. Each cut is moved just past the
+ * first newline found close to its nominal page-aligned position, so
+ * ranges normally hold whole lines, always with 'aligned', which drops a
+ * cut that has no newline close. Return the number of ranges. */
+int source_split(int fd, off_t off, off_t end, int prev, int n, int aligned, struct source_range *out);
+
+#endif /* SOURCE_H_ */
@@ -7,138 +7,710 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <pthread.h>
+#include <sys/stat.h>
 #include <r9k/argparse.h>
 #include <r9k/string.h>
 #include <r9k/panic.h>
 
-#define BUFSIZE 262144 /* 256kb */
+#include "cache.h"
+#include "counter.h"
+#include "csv.h"
+#include "delim.h"
+#include "dfa.h"
+#include "distinct.h"
+#include "estimate.h"
+#include "follow.h"
+#include "lineidx.h"
+#include "match.h"
+#include "ndjson.h"
+#include "pool.h"
+#include "simd.h"
+#include "source.h"
+#include "tar.h"
+#include "topk.h"
+#include "utf8.h"
+#include "uring.h"
+#include "walk.h"
 
-struct worker_arg_t
+/* -j beyond this many workers per CPU is refused */
+#define JOBS_PER_CPU 8
+
+/* Files of at least two of these are split into ranges counted by
+ * several workers at once. */
+#define SPLIT_MIN ((off_t) 64 << 20) /* 64mb */
+#define SPLIT_MAX 256                   /* ranges of one file at most */
+
+/* Small files are batched onto io_uring when there are enough of them. */
+#define URING_MAX   ((off_t) 256 << 10) /* 256kb */
+#define URING_MIN   16
+#define URING_BATCH 1024                /* files per ring */
+
+struct run_t
+{
+        unsigned int flags;
+        struct source_opts opts;
+        int njobs;
+        struct cache *cache;            /* NULL without --cache */
+        int index;                      /* --index */
+        int no_uring;
+};
+
+struct task_t
 {
         const char *path;
-        struct option *m;
-        struct option *l;
-        ssize_t ret;
+        const struct source_opts *opts;
+        struct source_range range;      /* range.end < 0 reads the whole stream */
+        struct counter ctr;
         int err;
 };
 
-static size_t utf8len(const char *str)
+struct file_t
+{
+        const char *path;
+        struct counter ctr;             /* cached counts, tasks are merged in */
+        struct stat st;                 /* as planned, valid when 'store' is set */
+        int store;                      /* save the result in the cache */
+        int index;                      /* save the line index */
+        int grown;                      /* ... appending the new samples only */
+        off_t size;                     /* scheduling hint, 0 if unknown */
+        struct task_t *tasks;
+        int ntasks;
+};
+
+static void stream_count_worker(void *_arg)
 {
-        size_t len = 0;
+        struct task_t *task = _arg;
 
-        while (*str) {
-                unsigned char m = (unsigned char) *str;
-                str++;
-                if ((m & 0xC0) != 0x80)
-                        len++;
+        if (task->range.end < 0) {
+                task->err = source_count_path(task->path, task->opts, &task->ctr);
+                return;
+        }
+
+        int fd = source_open(task->path, task->opts);
+        if (fd < 0) {
+                task->err = errno;
+                return;
         }
 
-        return len;
+        task->err = source_count_range(fd, task->range.off, task->range.end, task->opts, &task->ctr);
+
+        close(fd);
 }
 
-static size_t line_count(const char *buf, size_t size)
+/* Plan the tasks of one file. A cached file may need no task at all or
+ * only its appended tail, big regular files are cut into up to 'njobs'
+ * ranges, anything else is one task streaming to EOF. */
+static void plan_file(struct file_t *file, const struct run_t *run)
 {
-        size_t count = 0;
-        size_t len = 0;
+        struct source_range ranges[SPLIT_MAX];
+        struct cache_hit hit;
+        int n = 1;
+
+        ranges[0].off = 0;
+        ranges[0].end = -1;
+        ranges[0].prev = -1;
+
+        counter_init(&file->ctr, run->flags);
+
+        int fd = open(file->path, O_RDONLY);
+        if (fd >= 0 && fstat(fd, &file->st) == 0 && S_ISREG(file->st.st_mode)) {
+                off_t size = file->st.st_size;
+                file->size = size;
+
+                /* nothing to read when st_size alone answers */
+                int bytes_only = !run->opts.force_read && counter_bytes_only(&file->ctr);
+
+                if (run->cache && !bytes_only) {
+                        switch (cache_lookup(run->cache, fd, &file->st, run->flags, &hit)) {
+                        case CACHE_HIT:
+                                file->ctr.n = hit.n;
+                                n = 0;
+                                goto out;
+                        case CACHE_GROWN:
+                                file->ctr.n = hit.n;
+                                ranges[0].off = hit.size;
+                                ranges[0].prev = hit.last;
+                                break;
+                        }
+
+                        /* stop at the planned size, so the entry stored
+                         * afterwards describes exactly what was counted */
+                        ranges[0].end = size;
+                        file->store = 1;
+                }
+
+                if (run->index) {
+                        struct lineidx_cover cov;
+                        int found = lineidx_lookup(file->path, fd, &file->st, &cov);
+
+                        /* the index knows lines and bytes, and no more */
+                        if (run->flags & ~(CNT_LINES | CNT_BYTES | CNT_INDEX))
+                                found = LINEIDX_MISS;
+
+                        switch (found) {
+                        case LINEIDX_HIT:
+                                file->ctr.n.lines = cov.lines;
+                                file->ctr.n.bytes = (uint64_t) cov.size;
+                                n = 0;
+                                goto out;
+                        case LINEIDX_GROWN:
+                                file->ctr.n.lines = cov.lines;
+                                file->ctr.n.bytes = (uint64_t) cov.size;
+                                file->ctr.ix->lines = cov.lines;
+                                file->ctr.ix->pos = (uint64_t) cov.size;
+                                ranges[0].off = cov.size;
+                                ranges[0].prev = cov.last;
+                                file->grown = 1;
+                                break;
+                        }
+
+                        /* samples past the planned size would be unchecked */
+                        ranges[0].end = size;
+                        file->index = 1;
+                }
+
+                off_t parts = (size - ranges[0].off) / SPLIT_MIN;
+                if (parts > run->njobs)
+                        parts = run->njobs;
+                if (parts > SPLIT_MAX)
+                        parts = SPLIT_MAX;
+                if (parts > 1 && !bytes_only && counter_splittable(&file->ctr))
+                        n = source_split(fd, ranges[0].off, size, ranges[0].prev, (int) parts,
+                                         (run->flags & ~CNT_BASIC) != 0, ranges);
+        }
+
+out:
+        if (fd >= 0)
+                close(fd);
+
+        file->ntasks = n;
+        file->tasks = n ? calloc((size_t) n, sizeof(struct task_t)) : NULL;
+        PANIC_IF(n && !file->tasks, "ERROR: out of memory\n");
 
-        while (len < size) {
-                if (buf[len] == '\n')
-                        count++;
-                len++;
+        for (int i = 0; i < n; i++) {
+                file->tasks[i].path = file->path;
+                file->tasks[i].opts = &run->opts;
+                file->tasks[i].range = ranges[i];
+                counter_init(&file->tasks[i].ctr, run->flags);
+                counter_seed(&file->tasks[i].ctr, ranges[i].prev);
         }
+}
+
+static void index_file(const struct file_t *file)
+{
+        int fd = open(file->path, O_RDONLY);
+        if (fd < 0)
+                return;
+
+        int err = lineidx_store(file->path, fd, &file->st, file->ctr.ix, file->grown);
+        if (err != 0)
+                fprintf(stderr, "WARNING: %s: index: %s\n", file->path, strerror(err));
 
-        return count;
+        close(fd);
 }
 
-static ssize_t stream_count(FILE *fptr, struct option *m, struct option *l, int *err)
+static void cache_file(struct cache *cache, const struct file_t *file)
 {
-        char buf[BUFSIZE + 1];
-        ssize_t total = 0;
-        ssize_t n;
+        int fd = open(file->path, O_RDONLY);
+        if (fd < 0)
+                return;
 
-        while ((n = (ssize_t) fread(buf, 1, BUFSIZE, fptr)) > 0) {
-                if (m) {
-                        buf[n] = '\0';
-                        total += (ssize_t) utf8len(buf);
-                } else if (l) {
-                       total += (ssize_t) line_count(buf, n);
-                } else {
-                        total += n;
-                }
+        int err = cache_store(cache, fd, &file->st, file->ctr.flags, &file->ctr.n);
+        if (err != 0)
+                fprintf(stderr, "WARNING: %s: cache: %s\n", file->path, strerror(err));
+
+        close(fd);
+}
+
+struct sched_t
+{
+        struct task_t *task;
+        off_t size;
+};
+
+struct batch_t
+{
+        struct sched_t *items;
+        size_t n;
+};
+
+static void uring_count_worker(void *_arg)
+{
+        struct batch_t *batch = _arg;
+        struct uring_job jobs[batch->n];
+
+        for (size_t i = 0; i < batch->n; i++) {
+                jobs[i].path = batch->items[i].task->path;
+                jobs[i].size = batch->items[i].size;
+                jobs[i].ctr = &batch->items[i].task->ctr;
+                jobs[i].err = 0;
         }
 
-        if (ferror(fptr)) {
-                *err = errno;
-                return -1;
+        /* no ring after all, plain reads */
+        if (uring_count(jobs, batch->n) != 0) {
+                for (size_t i = 0; i < batch->n; i++)
+                        stream_count_worker(batch->items[i].task);
+                return;
         }
 
-        return total;
+        for (size_t i = 0; i < batch->n; i++)
+                batch->items[i].task->err = jobs[i].err;
 }
 
-static void *stream_count_worker(void *_arg)
+/* Submit the schedule, biggest first. The small whole-file tail goes to
+ * io_uring batches when worthwhile, return the batches to free. */
+static struct batch_t *submit_all(struct pool *pool, struct sched_t *order, size_t norder, const struct run_t *run)
 {
-        struct worker_arg_t *arg = _arg;
+        struct batch_t *batches = NULL;
+        size_t nsmall = 0;
 
-        FILE* fp = fopen(arg->path, "r");
-        if (!fp) {
-                arg->err = errno;
-                goto out;
+        /* the ring reads through the page cache */
+        if (!run->no_uring && !run->opts.no_cache && !(run->flags == CNT_BYTES && !run->opts.force_read)) {
+                while (nsmall < norder) {
+                        struct sched_t *it = &order[norder - nsmall - 1];
+                        if (it->task->range.end >= 0 || it->size == 0 || it->size > URING_MAX)
+                                break;
+                        nsmall++;
+                }
         }
 
-        arg->ret = stream_count(fp, arg->m, arg->l, &arg->err);
+        if (nsmall < URING_MIN || !uring_available())
+                nsmall = 0;
 
-        fclose(fp);
+        for (size_t i = 0; i < norder - nsmall; i++)
+                PANIC_IF(pool_submit(pool, stream_count_worker, order[i].task) != 0, "ERROR: out of memory\n");
 
-out:
-        return NULL;
+        if (nsmall == 0)
+                return NULL;
+
+        size_t nbatch = (nsmall + URING_BATCH - 1) / URING_BATCH;
+        batches = calloc(nbatch, sizeof(*batches));
+        PANIC_IF(!batches, "ERROR: out of memory\n");
+
+        for (size_t i = 0; i < nbatch; i++) {
+                batches[i].items = &order[norder - nsmall + i * URING_BATCH];
+                batches[i].n = i + 1 < nbatch ? URING_BATCH : nsmall - i * URING_BATCH;
+                PANIC_IF(pool_submit(pool, uring_count_worker, &batches[i]) != 0, "ERROR: out of memory\n");
+        }
+
+        return batches;
 }
 
-static void process_stream(struct option *f,
-                           struct option *m,
-                           struct option *l)
+/* largest first, so a big job doesn't start last and dominate the tail */
+static int cmp_size_desc(const void *a, const void *b)
 {
-        ssize_t total = 0;
+        const struct sched_t *x = a;
+        const struct sched_t *y = b;
+
+        return (x->size < y->size) - (x->size > y->size);
+}
+
+static void process_stream(struct option *f, const struct run_t *run)
+{
+        struct counter total;
+        struct file_t *files;
+        struct sched_t *order = NULL;
+        size_t norder = 0;
+        struct pool *pool;
+        int njobs = run->njobs;
+
+        counter_init(&total, run->flags);
 
         /* read stdin */
         if (f == NULL) {
-                int err = 0;
-                total = stream_count(stdin, m, l, &err);
-                PANIC_IF(total < 0, "ERROR: %s\n", strerror(err));
-                printf("%ld\n", total);
+                int err = source_count_fd(STDIN_FILENO, &run->opts, &total);
+                PANIC_IF(err != 0, "ERROR: %s\n", strerror(err));
+                counter_finish(&total);
+                counter_print(&total, NULL);
+                counter_free(&total);
                 return;
         }
+        counter_total(&total);
+
+        files = calloc(f->nval, sizeof(*files));
+        PANIC_IF(!files, "ERROR: out of memory\n");
+
+        for (uint32_t i = 0; i < f->nval; i++) {
+                files[i].path = f->vals[i];
+                plan_file(&files[i], run);
+
+                order = realloc(order, (norder + (size_t) files[i].ntasks) * sizeof(*order));
+                PANIC_IF(files[i].ntasks && !order, "ERROR: out of memory\n");
+
+                for (int k = 0; k < files[i].ntasks; k++) {
+                        struct task_t *task = &files[i].tasks[k];
+                        order[norder].task = task;
+                        order[norder].size = task->range.end < 0 ? files[i].size : task->range.end - task->range.off;
+                        norder++;
+                }
+        }
 
-        pthread_t threads[f->nval];
-        struct worker_arg_t args[f->nval];
+        qsort(order, norder, sizeof(*order), cmp_size_desc);
 
-        /* create thread */
+        if ((size_t) njobs > norder)
+                njobs = norder ? (int) norder : 1;
+
+        pool = pool_create(njobs);
+        PANIC_IF(!pool, "ERROR: failed to start workers\n");
+
+        struct batch_t *batches = submit_all(pool, order, norder, run);
+
+        pool_destroy(pool);
+        free(batches);
+
+        /* merge ranges and print in argument order */
         for (uint32_t i = 0; i < f->nval; i++) {
-                args[i].path = f->vals[i];
-                args[i].m = m;
-                args[i].l = l;
-                args[i].ret = 0;
-                args[i].err = 0;
-                pthread_create(&threads[i], NULL, stream_count_worker, &args[i]);
+                struct counter *ctr = &files[i].ctr;
+
+                for (int k = 0; k < files[i].ntasks; k++) {
+                        if (files[i].tasks[k].err != 0)
+                                PANIC("ERROR: %s: %s\n", files[i].path, strerror(files[i].tasks[k].err));
+                        counter_merge(ctr, &files[i].tasks[k].ctr);
+                        counter_free(&files[i].tasks[k].ctr);
+                }
+
+                if (files[i].store)
+                        cache_file(run->cache, &files[i]);
+                if (files[i].index)
+                        index_file(&files[i]);
+
+                counter_finish(ctr);
+                counter_print(ctr, files[i].path);
+                counter_merge(&total, ctr);
+                counter_free(ctr);
+                free(files[i].tasks);
+        }
+
+        if (f->nval > 1)
+                counter_print(&total, "total");
+
+        counter_free(&total);
+
+        free(order);
+        free(files);
+}
+
+struct found_t
+{
+        char *path;
+        const struct source_opts *opts;
+        struct counter ctr;
+        int err;
+};
+
+struct tree_t
+{
+        const struct run_t *run;
+        struct pool *pool;
+        pthread_mutex_t lock;
+        struct found_t **found;
+        size_t nfound;
+        size_t cap;
+};
+
+static void tree_count_worker(void *_arg)
+{
+        struct found_t *found = _arg;
+
+        found->err = source_count_path(found->path, found->opts, &found->ctr);
+}
+
+/* walk callback, queue the file for counting right away */
+static void tree_add(void *ctx, char *path)
+{
+        struct tree_t *tree = ctx;
+        struct found_t *found = malloc(sizeof(*found));
+
+        PANIC_IF(!found, "ERROR: out of memory\n");
+
+        found->path = path;
+        found->opts = &tree->run->opts;
+        found->err = 0;
+        counter_init(&found->ctr, tree->run->flags);
+
+        pthread_mutex_lock(&tree->lock);
+        if (tree->nfound == tree->cap) {
+                tree->cap = tree->cap ? tree->cap * 2 : 1024;
+                tree->found = realloc(tree->found, tree->cap * sizeof(*tree->found));
+                PANIC_IF(!tree->found, "ERROR: out of memory\n");
+        }
+        tree->found[tree->nfound++] = found;
+        pthread_mutex_unlock(&tree->lock);
+
+        PANIC_IF(pool_submit(tree->pool, tree_count_worker, found) != 0, "ERROR: out of memory\n");
+}
+
+static int cmp_found_path(const void *a, const void *b)
+{
+        const struct found_t *x = *(struct found_t *const *) a;
+        const struct found_t *y = *(struct found_t *const *) b;
+
+        return strcmp(x->path, y->path);
+}
+
+/* Count every regular file below the -r roots, walking and counting on
+ * the same pool, then print sorted by path. */
+static void process_tree(struct option *r, const struct walk_opts *wopts, const struct run_t *run)
+{
+        struct tree_t tree;
+        struct walk walk;
+        struct counter total;
+
+        memset(&tree, 0, sizeof(tree));
+        tree.run = run;
+        tree.pool = pool_create(run->njobs);
+        PANIC_IF(!tree.pool, "ERROR: failed to start workers\n");
+        pthread_mutex_init(&tree.lock, NULL);
+
+        walk.pool = tree.pool;
+        walk.opts = wopts;
+        walk.fn = tree_add;
+        walk.ctx = &tree;
+
+        for (uint32_t i = 0; i < r->nval; i++) {
+                int err = walk_start(&walk, r->vals[i]);
+                if (err != 0)
+                        fprintf(stderr, "WARNING: %s: %s\n", r->vals[i], strerror(err));
         }
 
-        /* run thread */
+        pool_wait(tree.pool);
+        pool_destroy(tree.pool);
+        pthread_mutex_destroy(&tree.lock);
+
+        qsort(tree.found, tree.nfound, sizeof(*tree.found), cmp_found_path);
+
+        counter_init(&total, run->flags);
+        counter_total(&total);
+
+        for (size_t i = 0; i < tree.nfound; i++) {
+                struct found_t *found = tree.found[i];
+
+                if (found->err != 0) {
+                        fprintf(stderr, "WARNING: %s: %s\n", found->path, strerror(found->err));
+                } else {
+                        counter_finish(&found->ctr);
+                        counter_print(&found->ctr, found->path);
+                        counter_merge(&total, &found->ctr);
+                }
+
+                counter_free(&found->ctr);
+                free(found->path);
+                free(found);
+        }
+
+        counter_print(&total, "total");
+        counter_free(&total);
+
+        free(tree.found);
+}
+
+static void print_estimate(const struct estimate *est, const char *name)
+{
+        uint64_t lo, hi;
+
+        estimate_interval(est, &lo, &hi);
+        printf("%8" PRIu64 " %s\n", est->lines, name);
+        printf("        95%% interval %" PRIu64 " - %" PRIu64 ", %" PRIu64 " of %" PRIu64 " bytes read\n",
+               lo, hi, est->sampled, est->size);
+}
+
+/* -l --estimate, sample regular files instead of reading them. Anything
+ * without a trustworthy size is counted whole. */
+static void process_estimate(struct option *f, const struct run_t *run)
+{
+        struct estimate total;
+
+        memset(&total, 0, sizeof(total));
+
         for (uint32_t i = 0; i < f->nval; i++) {
-                pthread_join(threads[i], NULL);
-                if (args[i].err != 0)
-                        PANIC("ERROR: %s: %s\n", args[i].path, strerror(args[i].err));
-                printf("%8ld %s\n", args[i].ret, args[i].path);
-                total += args[i].ret;
+                const char *path = f->vals[i];
+                struct estimate est;
+                struct stat st;
+                int err;
+
+                int fd = open(path, O_RDONLY);
+                PANIC_IF(fd < 0, "ERROR: %s: %s\n", path, strerror(errno));
+
+                if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+                        err = estimate_lines(fd, st.st_size, &est);
+                } else {
+                        struct counter ctr;
+
+                        counter_init(&ctr, CNT_LINES);
+                        err = source_count_fd(fd, &run->opts, &ctr);
+                        memset(&est, 0, sizeof(est));
+                        est.lines = est.seen = ctr.n.lines;
+                        est.sampled = est.size = ctr.n.bytes;
+                        counter_free(&ctr);
+                }
+
+                close(fd);
+                PANIC_IF(err != 0, "ERROR: %s: %s\n", path, strerror(err));
+
+                print_estimate(&est, path);
+
+                total.lines += est.lines;
+                total.var += est.var;
+                total.seen += est.seen;
+                total.sampled += est.sampled;
+                total.size += est.size;
         }
 
         if (f->nval > 1)
-                printf("%8ld total\n", total);
+                print_estimate(&total, "total");
+}
+
+/* --print-lines, copy a range of lines of each file, seeking with its
+ * index when there is a current one. */
+static void process_print(struct option *f, uint64_t first, uint64_t last)
+{
+        for (uint32_t i = 0; i < f->nval; i++) {
+                const char *path = f->vals[i];
+                int indexed;
+
+                int fd = open(path, O_RDONLY);
+                PANIC_IF(fd < 0, "ERROR: %s: %s\n", path, strerror(errno));
+
+                int err = lineidx_print(path, fd, first, last, &indexed);
+                close(fd);
+                PANIC_IF(err != 0, "ERROR: %s: %s\n", path, strerror(err));
+
+                if (!indexed)
+                        fprintf(stderr, "WARNING: %s: no current index, read from the start\n", path);
+        }
+}
+
+struct tar_run
+{
+        const char *archive;            /* prefix of member names, NULL for one archive */
+        struct counter total;
+};
+
+static void tar_member(void *ctx, const char *name, struct counter *ctr)
+{
+        struct tar_run *tr = ctx;
+
+        if (tr->archive) {
+                size_t len = strlen(tr->archive) + strlen(name) + 2;
+                char *full = malloc(len);
+                PANIC_IF(!full, "ERROR: out of memory\n");
+                snprintf(full, len, "%s:%s", tr->archive, name);
+                counter_print(ctr, full);
+                free(full);
+        } else {
+                counter_print(ctr, name);
+        }
+
+        counter_merge(&tr->total, ctr);
+}
+
+/* --tar, count each member of the archives given with -f, or of stdin,
+ * then the total. */
+static void process_tar(struct option *f, const struct run_t *run)
+{
+        uint32_t n = f ? f->nval : 1;
+        struct tar_run tr;
+
+        counter_init(&tr.total, run->flags);
+        counter_total(&tr.total);
+
+        for (uint32_t i = 0; i < n; i++) {
+                const char *path = f ? f->vals[i] : "stdin";
+                const char *why;
+
+                int fd = f ? open(path, O_RDONLY) : STDIN_FILENO;
+                PANIC_IF(fd < 0, "ERROR: %s: %s\n", path, strerror(errno));
+
+                tr.archive = n > 1 ? path : NULL;
+                int err = tar_count(fd, run->flags, tar_member, &tr, &why);
+                PANIC_IF(err == EINVAL && why, "ERROR: %s: %s\n", path, why);
+                PANIC_IF(err != 0, "ERROR: %s: %s\n", path, strerror(err));
+
+                if (f)
+                        close(fd);
+        }
+
+        counter_print(&tr.total, "total");
+        counter_free(&tr.total);
+}
+
+static long parse_num(const struct option *opt, long min)
+{
+        char *end;
+        long v;
+
+        errno = 0;
+        v = strtol(opt->sval, &end, 10);
+        PANIC_IF(errno != 0 || *end != '\0' || end == opt->sval || v < min,
+                 "ERROR: invalid value for %s%s: %s\n", opt->shortopt ? "-" : "--",
+                 opt->shortopt ? opt->shortopt : opt->longopt, opt->sval);
+
+        return v;
+}
+
+/* A[:B] of 1-based lines, B open ended when left out after the colon. */
+static void parse_lines(const struct option *opt, uint64_t *first, uint64_t *last)
+{
+        char *end;
+
+        errno = 0;
+        *first = strtoull(opt->sval, &end, 10);
+        *last = *first;
+
+        if (*end == ':' && end[1] == '\0') {
+                *last = UINT64_MAX;
+                end++;
+        } else if (*end == ':') {
+                const char *from = end + 1;
+                *last = strtoull(from, &end, 10);
+                if (end == from)
+                        *last = 0;
+        }
+
+        PANIC_IF(errno != 0 || *end != '\0' || end == opt->sval || *first == 0 || *last < *first
+                 || opt->sval[0] == '-' || strchr(opt->sval, '+'),
+                 "ERROR: invalid value for --%s: %s\n", opt->longopt, opt->sval);
+}
+
+static double parse_secs(const struct option *opt)
+{
+        char *end;
+        double v;
+
+        errno = 0;
+        v = strtod(opt->sval, &end);
+        PANIC_IF(errno != 0 || *end != '\0' || end == opt->sval || !(v > 0),
+                 "ERROR: invalid value for --%s: %s\n", opt->longopt, opt->sval);
+
+        return v;
 }
 
 int main(int argc, char* argv[])
 {
         struct argparse *ap;
-        struct option *c, *m, *l, *f;
+        struct option *c, *m, *l, *w, *d, *u, *L, *p, *e, *f;
+        struct option *populate, *no_mmap, *no_uring, *no_cache, *force_read, *jobs, *cache;
+        struct option *top, *top_words, *max_keys;
+        struct option *distinct, *field, *exact;
+        struct option *estimate;
+        struct option *csv, *csv_sep;
+        struct option *ndjson;
+        struct option *index, *index_step, *print_lines;
+        struct option *tar;
+        struct option *follow, *interval;
+        struct option *r, *include, *exclude;
+        struct walk_opts wopts;
+        struct run_t run;
+        struct matcher *matcher = NULL;
+        struct regex *regex = NULL;
+        struct delim *delim = NULL;
+        unsigned int flags = 0;
+
+        simd_init();
 
         ap = argparse_create("strc", "1.0");
         PANIC_IF(!ap, "argparse initialize failed");
@@ -146,27 +718,214 @@ int main(int argc, char* argv[])
         argparse_add0(ap, &c, "c", NULL, "count bytes.", NULL, 0);
         argparse_add0(ap, &m, "m", NULL, "count UTF-8 characters", NULL, 0);
         argparse_add0(ap, &l, "l", NULL, "count line.", NULL, 0);
-        argparse_addn(ap, &f, "f", NULL, "count files.", "path", 128, NULL, O_REQUIRED);
-
-        argparse_mutual_exclude(ap, &c, &m, &l);
+        argparse_add0(ap, &w, "w", NULL, "count words.", NULL, 0);
+        argparse_add1(ap, &d, "d", "delim", "count records ending in a delimiter instead of lines, escapes \\n \\r \\t \\0 \\xHH.", "delim", NULL, O_REQUIRED);
+        argparse_add0(ap, &u, "u", "utf8", "count characters and check they are valid UTF-8.", NULL, 0);
+        argparse_add0(ap, &estimate, NULL, "estimate", "with -l, extrapolate from a sample of each file.", NULL, 0);
+        argparse_add0(ap, &csv, NULL, "csv", "count CSV records, fields and malformed records.", NULL, 0);
+        argparse_add1(ap, &csv_sep, NULL, "csv-sep", "with --csv, the field separator, default ','.", "c", NULL, O_REQUIRED);
+        argparse_add0(ap, &ndjson, NULL, "ndjson", "count well-formed and malformed JSON lines, list the first malformed ones (checks structure, not every syntax error).", NULL, 0);
+        argparse_add0(ap, &index, NULL, "index", "with -f, count lines and write or extend an index next to each file.", NULL, 0);
+        argparse_add1(ap, &index_step, NULL, "index-step", "with --index, lines between samples, default 4096.", "N", NULL, O_REQUIRED);
+        argparse_add1(ap, &print_lines, NULL, "print-lines", "print lines A to B of each -f file, seeking with its index.", "A[:B]", NULL, O_REQUIRED);
+        argparse_add0(ap, &tar, NULL, "tar", "count each member of tar archives given with -f or on stdin.", NULL, 0);
+        argparse_add0(ap, &L, "L", "line-stats", "line length min, max, mean and histogram.", NULL, 0);
+        argparse_addn(ap, &p, "p", NULL, "count lines holding a literal, and its occurrences.", "lit", INT_MAX, NULL, O_REQUIRED);
+        argparse_add1(ap, &e, "e", "regex", "count lines matching an extended regular expression.", "re", NULL, O_REQUIRED);
+        argparse_add1(ap, &top, NULL, "top", "print the K most frequent lines.", "K", NULL, O_REQUIRED);
+        argparse_add0(ap, &top_words, NULL, "top-words", "with --top, rank words instead of lines.", NULL, 0);
+        argparse_add1(ap, &max_keys, NULL, "max-keys", "with --top, approximate past N distinct keys per thread.", "N", NULL, O_REQUIRED);
+        argparse_add0(ap, &distinct, NULL, "distinct", "estimate the number of distinct lines.", NULL, 0);
+        argparse_add1(ap, &field, NULL, "field", "with --distinct, count the Nth whitespace separated field.", "N", NULL, O_REQUIRED);
+        argparse_add0(ap, &exact, NULL, "exact", "with --distinct, keep every key for an exact count.", NULL, 0);
+        argparse_add0(ap, &populate, NULL, "populate", "prefault mapped files.", NULL, 0);
+        argparse_add0(ap, &no_mmap, NULL, "no-mmap", "read files instead of mapping them.", NULL, 0);
+        argparse_add0(ap, &no_uring, NULL, "no-uring", "don't batch small files onto io_uring.", NULL, 0);
+        argparse_add0(ap, &no_cache, NULL, "no-cache", "stream files without keeping them in the page cache.", NULL, 0);
+        argparse_add0(ap, &force_read, NULL, "force-read", "read regular files for -c instead of trusting st_size.", NULL, 0);
+        argparse_addn(ap, &f, "f", NULL, "count files.", "path", INT_MAX, NULL, O_REQUIRED);
+        argparse_addn(ap, &r, "r", NULL, "count files below directories.", "dir", INT_MAX, NULL, O_REQUIRED);
+        argparse_addn(ap, &include, NULL, "include", "with -r, only count files matching a glob.", "glob", INT_MAX, NULL, O_REQUIRED);
+        argparse_addn(ap, &exclude, NULL, "exclude", "with -r, skip files and directories matching a glob.", "glob", INT_MAX, NULL, O_REQUIRED);
+        argparse_add1(ap, &jobs, "j", "jobs", "number of worker threads, default online CPUs, at most 8 per CPU.", "N", NULL, O_REQUIRED);
+        argparse_add0(ap, &follow, "F", "follow", "keep counting files as they grow.", NULL, 0);
+        argparse_add1(ap, &interval, NULL, "interval", "seconds between -F reports, default 1.", "sec", NULL, O_REQUIRED);
+        argparse_add1(ap, &cache, NULL, "cache", "reuse counts of unchanged or appended files.", "file", NULL, O_REQUIRED);
 
         if (argparse_run(ap, argc, argv) != 0)
                 PANIC("%s\n", argparse_error(ap));
 
-        if (f || argparse_count(ap) == 0) {
-                process_stream(f, m, l);
+        /* any combination is counted in one pass, bytes by default */
+        if (c) flags |= CNT_BYTES;
+        if (m) flags |= CNT_CHARS;
+        if (l) flags |= CNT_LINES;
+        if (w) flags |= CNT_WORDS;
+        if (d) flags |= CNT_LINES;
+        if (u) flags |= CNT_CHARS | CNT_UTF8;
+        if (L) flags |= CNT_LINES | CNT_LSTAT;
+        if (p) flags |= CNT_MATCH;
+        if (e) flags |= CNT_REGEX;
+        if (top) flags |= CNT_TOPK | (top_words ? CNT_WORDS : CNT_LINES);
+        if (distinct) flags |= CNT_DISTINCT | CNT_LINES;
+        if (csv) flags |= CNT_CSV;
+        if (ndjson) flags |= CNT_NDJSON;
+        if (index) flags |= CNT_LINES | CNT_INDEX;
+        PANIC_IF(print_lines && (flags || !f || r || follow || tar), "ERROR: --print-lines needs files given with -f and nothing to count\n");
+        if (!flags)
+                flags = CNT_BYTES;
+
+        memset(&run, 0, sizeof(run));
+        run.flags = flags;
+        run.opts.populate = populate != NULL;
+        run.opts.no_mmap = no_mmap != NULL;
+        run.opts.force_read = force_read != NULL;
+        run.opts.no_cache = no_cache != NULL;
+        run.no_uring = no_uring != NULL;
+        run.njobs = pool_ncpu();
+        if (jobs) {
+                long njobs = parse_num(jobs, 1);
+                PANIC_IF(njobs > (long) run.njobs * JOBS_PER_CPU,
+                         "ERROR: -j: at most %d jobs on %d CPUs\n", run.njobs * JOBS_PER_CPU, run.njobs);
+                run.njobs = (int) njobs;
+        }
+
+        if (p) {
+                matcher = match_compile(p->vals, p->nval);
+                PANIC_IF(!matcher && errno == EINVAL, "ERROR: -p: literals must be non-empty single lines\n");
+                PANIC_IF(!matcher, "ERROR: out of memory\n");
+        }
+
+        if (e) {
+                const char *why;
+                regex = regex_compile(e->sval, &why);
+                PANIC_IF(!regex, "ERROR: -e: %s\n", why);
+        }
+
+        counter_patterns(matcher, regex);
+
+        if (d) {
+                size_t len;
+                char *spec = delim_parse(d->sval, &len);
+                PANIC_IF(!spec && errno == EINVAL, "ERROR: -d: invalid delimiter: %s\n", d->sval);
+                PANIC_IF(!spec, "ERROR: out of memory\n");
+                PANIC_IF(flags & ~CNT_BASIC, "ERROR: -d only works with -l, -w, -m and -c\n");
+
+                if (len > 1) {
+                        delim = delim_compile(spec, len);
+                        PANIC_IF(!delim, "ERROR: out of memory\n");
+                }
+                counter_delimiter((unsigned char) spec[0], delim);
+                free(spec);
+        }
+
+        if (top)
+                topk_setup((size_t) parse_num(top, 1), top_words != NULL,
+                           max_keys ? (size_t) parse_num(max_keys, 1) : 0);
+
+        if (csv_sep) {
+                size_t len;
+                char *sep = delim_parse(csv_sep->sval, &len);
+                PANIC_IF(!sep && errno != EINVAL, "ERROR: out of memory\n");
+                PANIC_IF(!sep || len != 1 || *sep == '"' || *sep == '\n' || *sep == '\r',
+                         "ERROR: --csv-sep: invalid separator: %s\n", csv_sep->sval);
+                csv_setup((unsigned char) *sep);
+                free(sep);
+        }
+
+        if (tar)
+                PANIC_IF(r || follow || estimate || index || cache || argparse_count(ap) > 0,
+                         "ERROR: --tar cannot be combined with -r, -F, --estimate, --index, --cache or a string\n");
+
+        if (index) {
+                PANIC_IF(!f || r || follow || estimate, "ERROR: --index needs files given with -f\n");
+                PANIC_IF(d, "ERROR: --index cannot be combined with -d\n");
+                run.index = 1;
+        }
+
+        if (index_step) {
+                long step = parse_num(index_step, 1);
+                PANIC_IF(step > (long) UINT32_MAX, "ERROR: invalid value for --index-step: %s\n", index_step->sval);
+                lineidx_setup((uint64_t) step);
+        }
+
+        if (distinct)
+                distinct_setup(field ? (size_t) parse_num(field, 1) : 0, exact != NULL);
+
+        if (estimate) {
+                PANIC_IF(flags != CNT_LINES || d, "ERROR: --estimate only works with -l alone\n");
+                PANIC_IF(!f || r || follow, "ERROR: --estimate needs files given with -f\n");
+        }
+
+        if (follow) {
+                PANIC_IF(!f, "ERROR: -F requires files given with -f\n");
+                PANIC_IF(top || distinct, "ERROR: --top and --distinct cannot be combined with -F\n");
+                const char *failed;
+                int err = follow_run(f->vals, f->nval, flags, &run.opts, interval ? parse_secs(interval) : 1.0, &failed);
+                PANIC("ERROR: %s: %s\n", failed ? failed : "follow", strerror(err));
+        }
+
+        /* the cache keeps plain counts only */
+        if (cache && d) {
+                fprintf(stderr, "WARNING: --cache is ignored with -d\n");
+                cache = NULL;
+        }
+
+        if (cache && (flags & ~CNT_BASIC)) {
+                fprintf(stderr, "WARNING: --cache is ignored with -u, -L, -p, -e, --top, --distinct, --csv, --ndjson and --index\n");
+                cache = NULL;
+        }
+
+        if (cache && f) {
+                run.cache = cache_open(cache->sval);
+                PANIC_IF(!run.cache, "ERROR: %s: %s\n", cache->sval, strerror(errno));
+        }
+
+        if (tar) {
+                process_tar(f, &run);
+        } else if (print_lines) {
+                uint64_t first, last;
+                parse_lines(print_lines, &first, &last);
+                process_print(f, first, last);
+        } else if (estimate) {
+                process_estimate(f, &run);
+        } else if (r) {
+                PANIC_IF(f, "ERROR: -r cannot be combined with -f\n");
+                wopts.include = include ? include->vals : NULL;
+                wopts.ninclude = include ? include->nval : 0;
+                wopts.exclude = exclude ? exclude->vals : NULL;
+                wopts.nexclude = exclude ? exclude->nval : 0;
+                process_tree(r, &wopts, &run);
+        } else if (f || argparse_count(ap) == 0) {
+                process_stream(f, &run);
         } else {
                 const char *str = argparse_val(ap, 0);
-                if (m) {
-                        printf("  %ld\n", utf8len(str));
-                } else if (l) {
-                        printf("  %ld\n", line_count(str, strlen(str)));
-                } else {
-                        printf("  %ld\n", strlen(str));
-                }
+                struct counter ctr;
+
+                counter_init(&ctr, flags);
+                counter_feed(&ctr, str, strlen(str));
+                counter_finish(&ctr);
+                printf("  ");
+                counter_print(&ctr, NULL);
+                counter_free(&ctr);
         }
 
+        if (top)
+                topk_print();
+        if (distinct)
+                distinct_print();
+
+        if (run.cache)
+                cache_close(run.cache);
+
+        match_free(matcher);
+        regex_free(regex);
+        delim_free(delim);
+
         argparse_destroy(ap);
 
-        return 0;
+        /* -u gates input, so invalid UTF-8 fails the run */
+        if ((flags & CNT_UTF8) && utf8_seen_invalid())
+                return 1;
+
+        return (flags & CNT_NDJSON) && ndjson_seen_malformed() ? 1 : 0;
 }
\ No newline at end of file
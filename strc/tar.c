@@ -0,0 +1,392 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#define _GNU_SOURCE /* madvise, strndup */
+#include "tar.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TAR_BLOCK  512
+#define TAR_BUF    ((size_t) 1 << 20)   /* 1mb, read buffer of a stream */
+#define TAR_WINDOW ((off_t) 1 << 30)    /* 1gb, mapped at a time */
+#define PAX_MAX    ((uint64_t) 1 << 20) /* bigger extended headers are refused */
+#define NAME_LEN   (155 + 1 + 100 + 1)  /* ustar prefix, slash, name */
+
+struct reader
+{
+        int fd;
+        int mapped;                     /* windows of a regular file */
+        off_t size;                     /* ... its size */
+        off_t base;                     /* ... and the offset of buf[0] */
+        char *buf;
+        size_t len;                     /* valid bytes in buf */
+        size_t pos;                     /* next byte */
+};
+
+static int bad(const char **err, const char *why)
+{
+        *err = why;
+        return EINVAL;
+}
+
+/* Make 'want' bytes available at r->buf + r->pos, fewer only at the end
+ * of the stream. Return 0 on success otherwise an errno value. */
+static int fill(struct reader *r, size_t want)
+{
+        if (r->len - r->pos >= want)
+                return 0;
+
+        if (r->mapped) {
+                off_t off = r->base + (off_t) r->pos;
+                off_t base = off - off % (off_t) sysconf(_SC_PAGESIZE);
+
+                if (r->buf)
+                        munmap(r->buf, r->len);
+                r->buf = NULL;
+                r->len = r->pos = 0;
+                r->base = off;
+                if (off >= r->size)
+                        return 0;
+
+                size_t len = (size_t) (r->size - base < TAR_WINDOW ? r->size - base : TAR_WINDOW);
+                char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, r->fd, base);
+                if (map != MAP_FAILED) {
+                        madvise(map, len, MADV_SEQUENTIAL);
+                        r->buf = map;
+                        r->len = len;
+                        r->pos = (size_t) (off - base);
+                        r->base = base;
+                        return 0;
+                }
+
+                /* mapping refused by the filesystem, read the rest */
+                r->mapped = 0;
+                r->buf = malloc(TAR_BUF);
+                if (!r->buf)
+                        return ENOMEM;
+                if (lseek(r->fd, off, SEEK_SET) < 0)
+                        return errno;
+        }
+
+        memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+        r->len -= r->pos;
+        r->pos = 0;
+
+        while (r->len < want) {
+                ssize_t n = read(r->fd, r->buf + r->len, TAR_BUF - r->len);
+                if (n == 0)
+                        break;
+                if (n < 0) {
+                        if (errno == EINTR)
+                                continue;
+                        return errno;
+                }
+                r->len += (size_t) n;
+        }
+
+        return 0;
+}
+
+/* Pass 'size' bytes, fed to 'ctr' and copied to 'copy' when not NULL. */
+static int consume(struct reader *r, uint64_t size, struct counter *ctr, char *copy, const char **err)
+{
+        while (size > 0) {
+                int e = fill(r, 1);
+                if (e != 0)
+                        return e;
+
+                size_t n = r->len - r->pos;
+                if (n == 0)
+                        return bad(err, "truncated archive");
+                if (n > size)
+                        n = (size_t) size;
+
+                if (ctr)
+                        counter_feed(ctr, r->buf + r->pos, n);
+                if (copy) {
+                        memcpy(copy, r->buf + r->pos, n);
+                        copy += n;
+                }
+
+                r->pos += n;
+                size -= n;
+        }
+
+        return 0;
+}
+
+/* An octal field, or base-256 when the top bit is set, as GNU tar and
+ * star write values that don't fit. Return -1 when malformed. */
+static int number(const unsigned char *p, size_t n, uint64_t *v)
+{
+        size_t i = 0;
+
+        *v = 0;
+
+        if (p[0] & 0x80) {
+                if (p[0] == 0xff)
+                        return -1;
+                *v = p[0] & 0x7f;
+                for (i = 1; i < n; i++) {
+                        if (*v >> 56)
+                                return -1;
+                        *v = *v << 8 | p[i];
+                }
+                return 0;
+        }
+
+        while (i < n && p[i] == ' ')
+                i++;
+        for (; i < n && p[i] >= '0' && p[i] <= '7'; i++) {
+                if (*v >> 61)
+                        return -1;
+                *v = *v * 8 + (uint64_t) (p[i] - '0');
+        }
+
+        return i < n && p[i] != ' ' && p[i] != '\0' ? -1 : 0;
+}
+
+/* the checksum counts its own field as spaces */
+static int checksum_ok(const unsigned char *h)
+{
+        uint64_t sum = 0;
+        uint64_t want;
+
+        for (size_t i = 0; i < TAR_BLOCK; i++)
+                sum += i >= 148 && i < 156 ? ' ' : h[i];
+
+        return number(h + 148, 8, &want) == 0 && sum == want;
+}
+
+static int is_zero(const unsigned char *h)
+{
+        for (size_t i = 0; i < TAR_BLOCK; i++) {
+                if (h[i])
+                        return 0;
+        }
+
+        return 1;
+}
+
+static int is_compressed(const unsigned char *h)
+{
+        return (h[0] == 0x1f && h[1] == 0x8b)                           /* gzip */
+               || memcmp(h, "BZh", 3) == 0                              /* bzip2 */
+               || memcmp(h, "\xfd" "7zXZ", 5) == 0                      /* xz */
+               || memcmp(h, "\x28\xb5\x2f\xfd", 4) == 0;                /* zstd */
+}
+
+/* POSIX ustar splits long paths into prefix and name, old GNU headers
+ * keep other things where the prefix would be */
+static void header_name(const unsigned char *h, char *name)
+{
+        size_t plen = memcmp(h + 257, "ustar\0", 6) == 0 ? strnlen((const char *) h + 345, 155) : 0;
+        size_t nlen = strnlen((const char *) h, 100);
+
+        if (plen) {
+                memcpy(name, h + 345, plen);
+                name[plen++] = '/';
+        }
+        memcpy(name + plen, h, nlen);
+        name[plen + nlen] = '\0';
+}
+
+/* "<len> <key>=<value>\n" records, keep the path and size. */
+static int pax_parse(const char *p, size_t n, char **path, uint64_t *size, int *has_size)
+{
+        while (n > 0) {
+                size_t len = 0;
+                size_t i = 0;
+
+                for (; i < n && i < 20 && p[i] >= '0' && p[i] <= '9'; i++)
+                        len = len * 10 + (size_t) (p[i] - '0');
+                if (i == 0 || i >= n || p[i] != ' ' || len < i + 3 || len > n || p[len - 1] != '\n')
+                        return -1;
+
+                const char *kv = p + i + 1;
+                size_t kvlen = len - i - 2;
+                const char *eq = memchr(kv, '=', kvlen);
+                if (!eq)
+                        return -1;
+
+                size_t klen = (size_t) (eq - kv);
+                size_t vlen = kvlen - klen - 1;
+
+                if (klen == 4 && memcmp(kv, "path", 4) == 0) {
+                        free(*path);
+                        *path = strndup(eq + 1, vlen);
+                        if (!*path)
+                                return -1;
+                } else if (klen == 4 && memcmp(kv, "size", 4) == 0) {
+                        *size = 0;
+                        for (size_t k = 0; k < vlen; k++) {
+                                if (eq[1 + k] < '0' || eq[1 + k] > '9' || *size > UINT64_MAX / 10)
+                                        return -1;
+                                *size = *size * 10 + (uint64_t) (eq[1 + k] - '0');
+                        }
+                        *has_size = 1;
+                }
+
+                p += len;
+                n -= len;
+        }
+
+        return 0;
+}
+
+/* Read the payload of an extended header or long name. */
+static int take(struct reader *r, uint64_t size, char **out, const char **err)
+{
+        if (size > PAX_MAX)
+                return bad(err, "extended header too large");
+
+        *out = malloc((size_t) size + 1);
+        if (!*out)
+                return ENOMEM;
+
+        int e = consume(r, size, NULL, *out, err);
+        (*out)[size] = '\0';
+
+        return e;
+}
+
+int tar_count(int fd, unsigned int flags, tar_fn_t fn, void *ctx, const char **err)
+{
+        struct reader r;
+        struct stat st;
+        char name[NAME_LEN];
+        char *long_name = NULL;         /* pax or GNU path of the next member */
+        uint64_t pax_size = 0;
+        int has_size = 0;
+        int first = 1;
+        int e = 0;
+
+        memset(&r, 0, sizeof(r));
+        r.fd = fd;
+        *err = NULL;
+
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (r.base = lseek(fd, 0, SEEK_CUR)) >= 0) {
+                r.mapped = 1;
+                r.size = st.st_size;
+        } else {
+                r.base = 0;
+                r.buf = malloc(TAR_BUF);
+                if (!r.buf)
+                        return ENOMEM;
+        }
+
+        for (;;) {
+                uint64_t size;
+                char *data = NULL;
+
+                e = fill(&r, TAR_BLOCK);
+                if (e != 0)
+                        break;
+
+                /* a stream cut right after a member is taken as ended */
+                size_t avail = r.len - r.pos;
+                if (avail == 0)
+                        break;
+
+                const unsigned char *h = (const unsigned char *) r.buf + r.pos;
+                if (first && avail >= 6 && is_compressed(h)) {
+                        e = bad(err, "compressed archive, decompress it first");
+                        break;
+                }
+                if (avail < TAR_BLOCK) {
+                        e = bad(err, "truncated archive");
+                        break;
+                }
+                if (is_zero(h))
+                        break;
+                if (!checksum_ok(h) || number(h + 124, 12, &size) != 0) {
+                        e = bad(err, first ? "not a tar archive" : "bad header checksum");
+                        break;
+                }
+
+                char type = (char) h[156];
+                header_name(h, name);
+                r.pos += TAR_BLOCK;
+                first = 0;
+
+                uint64_t pad = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+
+                switch (type) {
+                case 'x':                       /* pax, for the next member */
+                        e = take(&r, size, &data, err);
+                        if (e == 0 && pax_parse(data, (size_t) size, &long_name, &pax_size, &has_size) != 0)
+                                e = bad(err, "bad extended header");
+                        free(data);
+                        e = e ? e : consume(&r, pad, NULL, NULL, err);
+                        if (e != 0)
+                                goto out;
+                        continue;
+                case 'L':                       /* GNU long name */
+                        e = take(&r, size, &data, err);
+                        free(long_name);
+                        long_name = data;
+                        e = e ? e : consume(&r, pad, NULL, NULL, err);
+                        if (e != 0)
+                                goto out;
+                        continue;
+                case 'K':                       /* GNU long link target */
+                case 'g':                       /* pax, global */
+                        e = consume(&r, size + pad, NULL, NULL, err);
+                        if (e != 0)
+                                goto out;
+                        continue;
+                case '0':
+                case '\0':
+                case '7': {
+                        struct counter ctr;
+
+                        if (has_size) {
+                                size = pax_size;
+                                pad = (TAR_BLOCK - size % TAR_BLOCK) % TAR_BLOCK;
+                        }
+
+                        /* the size is in the header, skip the data */
+                        counter_init(&ctr, flags);
+                        if (counter_bytes_only(&ctr)) {
+                                ctr.n.bytes += size;
+                                e = consume(&r, size, NULL, NULL, err);
+                        } else {
+                                e = consume(&r, size, &ctr, NULL, err);
+                        }
+
+                        if (e == 0) {
+                                counter_finish(&ctr);
+                                fn(ctx, long_name ? long_name : name, &ctr);
+                        }
+                        counter_free(&ctr);
+                        break;
+                }
+                default:                        /* links, directories, devices */
+                        e = consume(&r, size, NULL, NULL, err);
+                        break;
+                }
+
+                e = e ? e : consume(&r, pad, NULL, NULL, err);
+                if (e != 0)
+                        break;
+
+                free(long_name);
+                long_name = NULL;
+                has_size = 0;
+        }
+
+out:
+        free(long_name);
+        if (r.mapped && r.buf)
+                munmap(r.buf, r.len);
+        else if (!r.mapped)
+                free(r.buf);
+
+        return e;
+}
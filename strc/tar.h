@@ -0,0 +1,26 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * tar - count the members of a tar stream without extracting them
+ *
+ * Headers are parsed as ustar, with pax extended headers and GNU long
+ * names for paths and sizes past the ustar fields. A regular archive file
+ * is mapped a window at a time and member payloads are fed to the counter
+ * straight from the mapping, anything else is read into one buffer and
+ * fed from there. Only regular members are counted, the rest is skipped.
+ */
+#ifndef TAR_H_
+#define TAR_H_
+
+#include "counter.h"
+
+/* Called with each regular member once its payload is counted. */
+typedef void (*tar_fn_t)(void *ctx, const char *name, struct counter *ctr);
+
+/* Count each regular member of the archive read from 'fd' with the
+ * metrics in 'flags'. Return 0 on success, otherwise an errno value and
+ * for a broken archive EINVAL with '*err' set to a message. */
+int tar_count(int fd, unsigned int flags, tar_fn_t fn, void *ctx, const char **err);
+
+#endif /* TAR_H_ */
@@ -0,0 +1,461 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#include "topk.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <r9k/panic.h>
+
+#include "hash.h"
+#include "util.h"
+
+/* count-min sketch, 4 rows of 64k counters, 2mb */
+#define CMS_DEPTH 4
+#define CMS_WIDTH ((size_t) 1 << 16)
+
+/* heavy hitters kept by an approximate table, per key asked for */
+#define HH_FACTOR 4
+#define HH_MIN    256
+
+struct table
+{
+        struct registry_node node;      /* all tables, for the final merge */
+
+        struct keyset keys;             /* exact */
+
+        /* approximate: keys malloc()ed, 'hh' holds at most 'nhh_max' */
+        int approx;
+        uint64_t *cms;
+        struct key_entry *hh;
+        size_t hh_cap;
+        size_t nhh;
+        size_t min;                     /* slot of the smallest heavy hitter */
+};
+
+static size_t top_k;
+static int by_words;
+static size_t key_limit;
+static size_t nhh_max;
+
+static struct registry tables = REGISTRY_INIT;
+
+void topk_setup(size_t k, int words, size_t max_keys)
+{
+        top_k = k;
+        by_words = words;
+        key_limit = max_keys;
+        nhh_max = k * HH_FACTOR > HH_MIN ? k * HH_FACTOR : HH_MIN;
+        registry_init(&tables);
+}
+
+/* --- approximate mode --- */
+
+static inline size_t cms_cell(uint64_t h, int row)
+{
+        uint32_t h1 = (uint32_t) h;
+        uint32_t h2 = (uint32_t) (h >> 32) | 1;
+
+        return (size_t) row * CMS_WIDTH + ((h1 + (uint32_t) row * h2) & (CMS_WIDTH - 1));
+}
+
+static uint64_t cms_add(struct table *t, uint64_t h, uint64_t count)
+{
+        uint64_t est = UINT64_MAX;
+
+        for (int r = 0; r < CMS_DEPTH; r++) {
+                uint64_t *c = &t->cms[cms_cell(h, r)];
+                *c += count;
+                if (*c < est)
+                        est = *c;
+        }
+
+        return est;
+}
+
+static uint64_t cms_query(const struct table *t, uint64_t h)
+{
+        uint64_t est = UINT64_MAX;
+
+        for (int r = 0; r < CMS_DEPTH; r++) {
+                uint64_t c = t->cms[cms_cell(h, r)];
+                if (c < est)
+                        est = c;
+        }
+
+        return est;
+}
+
+static void hh_rescan_min(struct table *t)
+{
+        t->min = SIZE_MAX;
+
+        for (size_t i = 0; i < t->hh_cap; i++) {
+                if (t->hh[i].count && (t->min == SIZE_MAX || t->hh[i].count < t->hh[t->min].count))
+                        t->min = i;
+        }
+}
+
+/* backward shift deletion keeps the probe chains intact */
+static void hh_remove(struct table *t, size_t i)
+{
+        size_t mask = t->hh_cap - 1;
+
+        free(t->hh[i].key);
+        t->hh[i].count = 0;
+        t->nhh--;
+
+        for (size_t j = (i + 1) & mask; t->hh[j].count; j = (j + 1) & mask) {
+                size_t home = t->hh[j].hash & mask;
+
+                /* move j into the hole unless its home lies in (i, j] */
+                if (((j - home) & mask) >= ((j - i) & mask)) {
+                        t->hh[i] = t->hh[j];
+                        t->hh[j].count = 0;
+                        i = j;
+                }
+        }
+}
+
+/* Offer a key whose estimated count is 'est' to the heavy hitters. */
+static void hh_offer(struct table *t, const char *key, size_t len, uint64_t h, uint64_t est)
+{
+        size_t mask = t->hh_cap - 1;
+        size_t i = h & mask;
+
+        for (; t->hh[i].count; i = (i + 1) & mask) {
+                if (same_key(&t->hh[i], h, key, len)) {
+                        t->hh[i].count = est;
+                        if (i == t->min)
+                                hh_rescan_min(t);
+                        return;
+                }
+        }
+
+        /* full, a key must beat the weakest one to get in */
+        int evicted = 0;
+        if (t->nhh == nhh_max) {
+                if (est <= t->hh[t->min].count)
+                        return;
+                hh_remove(t, t->min);
+                evicted = 1;
+                for (i = h & mask; t->hh[i].count; i = (i + 1) & mask)
+                        ;
+        }
+
+        char *copy = malloc(len ? len : 1);
+        PANIC_IF(!copy, "ERROR: out of memory\n");
+        memcpy(copy, key, len);
+
+        t->hh[i] = (struct key_entry) { h, est, copy, len };
+        t->nhh++;
+
+        if (evicted)
+                hh_rescan_min(t);
+        else if (t->min == SIZE_MAX || est < t->hh[t->min].count)
+                t->min = i;
+}
+
+/* Too many keys, move the counts into a sketch and keep only the heavy
+ * hitters by name. */
+static void to_approx(struct table *t)
+{
+        t->cms = calloc(CMS_DEPTH * CMS_WIDTH, sizeof(*t->cms));
+        t->hh_cap = 1;
+        while (t->hh_cap < 2 * nhh_max)
+                t->hh_cap <<= 1;
+        t->hh = calloc(t->hh_cap, sizeof(*t->hh));
+        PANIC_IF(!t->cms || !t->hh, "ERROR: out of memory\n");
+        t->min = SIZE_MAX;
+        t->approx = 1;
+
+        for (size_t i = 0; i < t->keys.cap; i++) {
+                if (t->keys.slots[i].count)
+                        cms_add(t, t->keys.slots[i].hash, t->keys.slots[i].count);
+        }
+
+        for (size_t i = 0; i < t->keys.cap; i++) {
+                const struct key_entry *e = &t->keys.slots[i];
+                if (e->count)
+                        hh_offer(t, e->key, e->len, e->hash, cms_query(t, e->hash));
+        }
+
+        keyset_free(&t->keys);
+}
+
+static void add_key(struct table *t, const char *key, size_t len, uint64_t h, uint64_t count)
+{
+        if (t->approx) {
+                hh_offer(t, key, len, h, cms_add(t, h, count));
+                return;
+        }
+
+        keyset_add(&t->keys, key, len, h, count);
+
+        if (key_limit && t->keys.n > key_limit)
+                to_approx(t);
+}
+
+/* The table of the calling thread, it outlives the thread so the counts
+ * are still there to merge. */
+static struct table *thread_table(void)
+{
+        struct table *t = registry_get(&tables);
+
+        if (t)
+                return t;
+
+        t = calloc(1, sizeof(*t));
+        PANIC_IF(!t, "ERROR: out of memory\n");
+        registry_add(&tables, &t->node);
+
+        return t;
+}
+
+struct topk_state *topk_state_new(void)
+{
+        return calloc(1, sizeof(struct topk_state));
+}
+
+void topk_state_free(struct topk_state *ts)
+{
+        if (ts) {
+                free(ts->part.buf);
+                free(ts);
+        }
+}
+
+void topk_reset(struct topk_state *ts)
+{
+        ts->part.len = 0;
+}
+
+/* a key ending at buf[len], joined to the open part if any */
+static void count_key(struct table *t, struct topk_state *ts, const char *buf, size_t len)
+{
+        if (ts->part.len) {
+                part_append(&ts->part, buf, len);
+                buf = ts->part.buf;
+                len = ts->part.len;
+                ts->part.len = 0;
+        }
+
+        add_key(t, buf, len, hash_bytes(buf, len), 1);
+}
+
+static void feed_lines(struct table *t, struct topk_state *ts, const char *buf, size_t n)
+{
+        size_t i = 0;
+
+        while (i < n) {
+                const char *nl = memchr(buf + i, '\n', n - i);
+                if (!nl) {
+                        part_append(&ts->part, buf + i, n - i);
+                        return;
+                }
+
+                size_t len = (size_t) (nl - (buf + i));
+                count_key(t, ts, buf + i, len);
+                i += len + 1;
+        }
+}
+
+static void feed_words(struct table *t, struct topk_state *ts, const char *buf, size_t n)
+{
+        size_t i = 0;
+
+        while (i < n) {
+                if (!ts->part.len) {
+                        while (i < n && is_ws((unsigned char) buf[i]))
+                                i++;
+                }
+
+                size_t start = i;
+                while (i < n && !is_ws((unsigned char) buf[i]))
+                        i++;
+
+                if (i == n) {
+                        part_append(&ts->part, buf + start, n - start);
+                        return;
+                }
+
+                count_key(t, ts, buf + start, i - start);
+        }
+}
+
+void topk_feed(struct topk_state *ts, const char *buf, size_t n)
+{
+        struct table *t = thread_table();
+
+        if (by_words)
+                feed_words(t, ts, buf, n);
+        else
+                feed_lines(t, ts, buf, n);
+}
+
+void topk_merge(struct topk_state *dst, const struct topk_state *src)
+{
+        dst->part.len = 0;
+        if (src->part.len)
+                part_append(&dst->part, src->part.buf, src->part.len);
+}
+
+void topk_finish(struct topk_state *ts)
+{
+        if (ts->part.len) {
+                count_key(thread_table(), ts, NULL, 0);
+                ts->part.len = 0;
+        }
+}
+
+static void merge(struct table *dst, struct table *src)
+{
+        if (!src->approx) {
+                for (size_t i = 0; i < src->keys.cap; i++) {
+                        const struct key_entry *e = &src->keys.slots[i];
+                        if (e->count)
+                                add_key(dst, e->key, e->len, e->hash, e->count);
+                }
+                return;
+        }
+
+        if (!dst->approx)
+                to_approx(dst);
+
+        for (size_t i = 0; i < CMS_DEPTH * CMS_WIDTH; i++)
+                dst->cms[i] += src->cms[i];
+
+        /* the sketch only grew, so do the estimates of kept keys */
+        for (size_t i = 0; i < dst->hh_cap; i++) {
+                if (dst->hh[i].count)
+                        dst->hh[i].count = cms_query(dst, dst->hh[i].hash);
+        }
+        hh_rescan_min(dst);
+
+        for (size_t i = 0; i < src->hh_cap; i++) {
+                const struct key_entry *e = &src->hh[i];
+                if (e->count)
+                        hh_offer(dst, e->key, e->len, e->hash, cms_query(dst, e->hash));
+        }
+}
+
+static void table_free(struct table *t)
+{
+        for (size_t i = 0; i < t->hh_cap; i++) {
+                if (t->hh[i].count)
+                        free(t->hh[i].key);
+        }
+
+        free(t->hh);
+        free(t->cms);
+        keyset_free(&t->keys);
+        free(t);
+}
+
+/* more frequent first, ties by key so the output doesn't depend on the
+ * number of workers */
+static int before(const struct key_entry *a, const struct key_entry *b)
+{
+        if (a->count != b->count)
+                return a->count > b->count;
+
+        size_t len = a->len < b->len ? a->len : b->len;
+        int c = memcmp(a->key, b->key, len);
+
+        return c ? c < 0 : a->len < b->len;
+}
+
+/* min-heap on before(), the root is the weakest of the top */
+static void sift_down(struct key_entry *heap, size_t n, size_t i)
+{
+        for (;;) {
+                size_t l = 2 * i + 1;
+                size_t r = l + 1;
+                size_t m = i;
+
+                if (l < n && before(&heap[m], &heap[l]))
+                        m = l;
+                if (r < n && before(&heap[m], &heap[r]))
+                        m = r;
+                if (m == i)
+                        return;
+
+                struct key_entry tmp = heap[i];
+                heap[i] = heap[m];
+                heap[m] = tmp;
+                i = m;
+        }
+}
+
+static void sift_up(struct key_entry *heap, size_t i)
+{
+        while (i > 0) {
+                size_t p = (i - 1) / 2;
+                if (!before(&heap[p], &heap[i]))
+                        return;
+
+                struct key_entry tmp = heap[i];
+                heap[i] = heap[p];
+                heap[p] = tmp;
+                i = p;
+        }
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+        return before(b, a) - before(a, b);
+}
+
+void topk_print(void)
+{
+        struct table *all = (struct table *) registry_take(&tables);
+        struct key_entry *slots;
+        size_t nslots;
+
+        if (!all) {
+                printf("top %zu %s:\n", top_k, by_words ? "words" : "lines");
+                return;
+        }
+
+        for (struct table *t = (struct table *) all->node.next; t; t = (struct table *) t->node.next)
+                merge(all, t);
+
+        slots = all->approx ? all->hh : all->keys.slots;
+        nslots = all->approx ? all->hh_cap : all->keys.cap;
+
+        struct key_entry *heap = malloc((top_k ? top_k : 1) * sizeof(*heap));
+        size_t n = 0;
+
+        PANIC_IF(!heap, "ERROR: out of memory\n");
+
+        for (size_t i = 0; i < nslots && top_k; i++) {
+                if (!slots[i].count)
+                        continue;
+                if (n < top_k) {
+                        heap[n] = slots[i];
+                        sift_up(heap, n++);
+                } else if (before(&slots[i], &heap[0])) {
+                        heap[0] = slots[i];
+                        sift_down(heap, n, 0);
+                }
+        }
+
+        qsort(heap, n, sizeof(*heap), cmp_entry);
+
+        printf("top %zu %s%s:\n", top_k, by_words ? "words" : "lines",
+               all->approx ? " (approximate, counts are upper bounds)" : "");
+        for (size_t i = 0; i < n; i++)
+                printf("%8" PRIu64 " %.*s\n", heap[i].count, (int) heap[i].len, heap[i].key);
+
+        free(heap);
+
+        while (all) {
+                struct table *next = (struct table *) all->node.next;
+                table_free(all);
+                all = next;
+        }
+}
@@ -0,0 +1,46 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * topk - most frequent lines or words
+ *
+ * Keys are counted in one hash table per thread, with key bytes kept in
+ * an arena, so workers never share a lock. topk_print() merges the tables
+ * and picks the top K with a heap. With a key limit a table that grows
+ * past it turns into a count-min sketch plus a bounded set of heavy
+ * hitters, trading exact counts for bounded memory.
+ */
+#ifndef TOPK_H_
+#define TOPK_H_
+
+#include <stddef.h>
+
+#include "util.h"
+
+/* Per stream state, the line or word still open at the end of the last
+ * buffer. */
+struct topk_state
+{
+        struct part part;
+};
+
+/* Rank the 'k' most frequent keys, words instead of lines with 'words'.
+ * 'max_keys' is the number of distinct keys a table may hold before going
+ * approximate, 0 for no limit. Must be called before any key is counted. */
+void topk_setup(size_t k, int words, size_t max_keys);
+
+struct topk_state *topk_state_new(void);
+void topk_state_free(struct topk_state *ts);
+/* Drop the open key, the next buffer starts a new line. */
+void topk_reset(struct topk_state *ts);
+void topk_feed(struct topk_state *ts, const char *buf, size_t n);
+/* 'src' continues the stream of 'dst', take over its open key. */
+void topk_merge(struct topk_state *dst, const struct topk_state *src);
+/* The stream has ended, count its open key. */
+void topk_finish(struct topk_state *ts);
+
+/* Merge what every thread counted and print the most frequent keys. No
+ * thread may be counting anymore. */
+void topk_print(void);
+
+#endif /* TOPK_H_ */
@@ -0,0 +1,336 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#define _GNU_SOURCE /* syscall, MAP_POPULATE, O_CLOEXEC */
+#include "uring.h"
+
+#include <errno.h>
+#include <r9k/compiler_attrs.h>
+
+#if defined(__linux__) && defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#    define HAVE_URING 1
+#  endif
+#endif
+
+#ifdef HAVE_URING
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define URING_SLOTS 64                  /* files in flight per ring */
+#define URING_BUF   65536               /* read size per request */
+
+/* what a slot waits for */
+#define ST_OPEN  0
+#define ST_READ  1
+#define ST_CLOSE 2
+
+struct ring
+{
+        int fd;
+        unsigned sq_entries;
+        unsigned *sq_head;
+        unsigned *sq_tail;
+        unsigned *sq_mask;
+        unsigned *sq_array;
+        unsigned sq_local;              /* tail not yet published */
+        unsigned *cq_head;
+        unsigned *cq_tail;
+        unsigned *cq_mask;
+        struct io_uring_sqe *sqes;
+        struct io_uring_cqe *cqes;
+        void *sq_map;
+        size_t sq_len;
+        void *cq_map;
+        size_t cq_len;
+        size_t sqes_len;
+};
+
+struct slot
+{
+        struct uring_job *job;
+        int state;
+        int fd;
+        off_t off;
+        char *buf;
+};
+
+static int ring_setup(struct ring *r, unsigned entries)
+{
+        struct io_uring_params p;
+
+        memset(&p, 0, sizeof(p));
+        memset(r, 0, sizeof(*r));
+
+        r->fd = (int) syscall(__NR_io_uring_setup, entries, &p);
+        if (r->fd < 0)
+                return errno;
+
+        r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+                if (r->cq_len > r->sq_len)
+                        r->sq_len = r->cq_len;
+                r->cq_len = 0;
+        }
+
+        r->sq_map = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+        if (r->sq_map == MAP_FAILED)
+                goto fail;
+
+        r->cq_map = r->sq_map;
+        if (r->cq_len) {
+                r->cq_map = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+                if (r->cq_map == MAP_FAILED)
+                        goto fail;
+        }
+
+        r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+        if (r->sqes == MAP_FAILED)
+                goto fail;
+
+        char *sq = r->sq_map;
+        char *cq = r->cq_map;
+
+        r->sq_entries = p.sq_entries;
+        r->sq_head = (unsigned *) (sq + p.sq_off.head);
+        r->sq_tail = (unsigned *) (sq + p.sq_off.tail);
+        r->sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+        r->sq_array = (unsigned *) (sq + p.sq_off.array);
+        r->sq_local = *r->sq_tail;
+        r->cq_head = (unsigned *) (cq + p.cq_off.head);
+        r->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+        r->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+        r->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+        return 0;
+
+fail:;
+        int err = errno;
+        if (r->sq_map && r->sq_map != MAP_FAILED)
+                munmap(r->sq_map, r->sq_len);
+        if (r->cq_len && r->cq_map && r->cq_map != MAP_FAILED)
+                munmap(r->cq_map, r->cq_len);
+        close(r->fd);
+        return err;
+}
+
+static void ring_free(struct ring *r)
+{
+        munmap(r->sqes, r->sqes_len);
+        if (r->cq_len)
+                munmap(r->cq_map, r->cq_len);
+        munmap(r->sq_map, r->sq_len);
+        close(r->fd);
+}
+
+/* Slots never outnumber sq entries, so a free sqe always exists. */
+static struct io_uring_sqe *ring_sqe(struct ring *r, int op, struct slot *s)
+{
+        unsigned idx = r->sq_local & *r->sq_mask;
+        struct io_uring_sqe *sqe = &r->sqes[idx];
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = (unsigned char) op;
+        sqe->user_data = (uint64_t) (uintptr_t) s;
+        r->sq_array[idx] = idx;
+        r->sq_local++;
+
+        return sqe;
+}
+
+static int ring_enter(struct ring *r)
+{
+        unsigned submit = r->sq_local - *r->sq_tail;
+
+        __atomic_store_n(r->sq_tail, r->sq_local, __ATOMIC_RELEASE);
+
+        for (;;) {
+                long ret = syscall(__NR_io_uring_enter, r->fd, submit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+                if (ret >= 0)
+                        return 0;
+                if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                        return errno;
+        }
+}
+
+static void queue_open(struct ring *r, struct slot *s)
+{
+        struct io_uring_sqe *sqe = ring_sqe(r, IORING_OP_OPENAT, s);
+
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t) (uintptr_t) s->job->path;
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        s->state = ST_OPEN;
+}
+
+static void queue_read(struct ring *r, struct slot *s)
+{
+        struct io_uring_sqe *sqe = ring_sqe(r, IORING_OP_READ, s);
+
+        sqe->fd = s->fd;
+        sqe->addr = (uint64_t) (uintptr_t) s->buf;
+        sqe->len = URING_BUF;
+        sqe->off = (uint64_t) s->off;
+        s->state = ST_READ;
+}
+
+static void queue_close(struct ring *r, struct slot *s)
+{
+        struct io_uring_sqe *sqe = ring_sqe(r, IORING_OP_CLOSE, s);
+
+        sqe->fd = s->fd;
+        s->state = ST_CLOSE;
+}
+
+/* Advance a slot after one of its requests completed, return non-zero
+ * when the slot's file is done. */
+static int complete(struct ring *r, struct slot *s, int res)
+{
+        switch (s->state) {
+        case ST_OPEN:
+                if (res < 0) {
+                        s->job->err = -res;
+                        return 1;
+                }
+                s->fd = res;
+                s->off = 0;
+                queue_read(r, s);
+                return 0;
+        case ST_READ:
+                if (res < 0) {
+                        s->job->err = -res;
+                } else if (res > 0) {
+                        counter_feed(s->job->ctr, s->buf, (size_t) res);
+                        s->off += res;
+                        /* read on until EOF, the size is only a hint */
+                        if (res == URING_BUF || s->off < s->job->size) {
+                                queue_read(r, s);
+                                return 0;
+                        }
+                }
+                queue_close(r, s);
+                return 0;
+        default:
+                return 1;
+        }
+}
+
+int uring_available(void)
+{
+        struct ring r;
+        struct io_uring_probe *probe;
+        size_t len = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+        int ok = 0;
+
+        if (ring_setup(&r, 4) != 0)
+                return 0;
+
+        probe = calloc(1, len);
+        if (probe && syscall(__NR_io_uring_register, r.fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+                ok = probe->last_op >= IORING_OP_CLOSE
+                     && (probe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED)
+                     && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)
+                     && (probe->ops[IORING_OP_CLOSE].flags & IO_URING_OP_SUPPORTED);
+        }
+
+        free(probe);
+        ring_free(&r);
+
+        return ok;
+}
+
+int uring_count(struct uring_job *jobs, size_t n)
+{
+        struct ring r;
+        struct slot slots[URING_SLOTS];
+        size_t next = 0;
+        size_t done = 0;
+        char *bufs;
+        int err;
+
+        err = ring_setup(&r, URING_SLOTS);
+        if (err != 0)
+                return err;
+
+        bufs = malloc((size_t) URING_SLOTS * URING_BUF);
+        if (!bufs) {
+                ring_free(&r);
+                return ENOMEM;
+        }
+
+        memset(slots, 0, sizeof(slots));
+
+        for (int i = 0; i < URING_SLOTS && next < n; i++) {
+                slots[i].buf = bufs + (size_t) i * URING_BUF;
+                slots[i].job = &jobs[next++];
+                queue_open(&r, &slots[i]);
+        }
+
+        while (done < n) {
+                err = ring_enter(&r);
+                if (err != 0) {
+                        /* the ring broke down, fail whatever is unfinished
+                         * and close what no queued close will */
+                        for (int i = 0; i < URING_SLOTS; i++) {
+                                if (slots[i].job && slots[i].state == ST_READ)
+                                        close(slots[i].fd);
+                                if (slots[i].job && slots[i].job->err == 0)
+                                        slots[i].job->err = err;
+                        }
+                        for (; next < n; next++)
+                                jobs[next].err = err;
+                        err = 0;
+                        break;
+                }
+
+                unsigned head = *r.cq_head;
+                unsigned tail = __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE);
+
+                for (; head != tail; head++) {
+                        struct io_uring_cqe *cqe = &r.cqes[head & *r.cq_mask];
+                        struct slot *s = (struct slot *) (uintptr_t) cqe->user_data;
+
+                        if (!complete(&r, s, cqe->res))
+                                continue;
+
+                        done++;
+                        s->job = NULL;
+                        if (next < n) {
+                                s->job = &jobs[next++];
+                                queue_open(&r, s);
+                        }
+                }
+
+                __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+        }
+
+        free(bufs);
+        ring_free(&r);
+
+        return err;
+}
+
+#else /* HAVE_URING */
+
+int uring_available(void)
+{
+        return 0;
+}
+
+int uring_count(struct uring_job *jobs, size_t n)
+{
+        __attr_ignore2(jobs, n);
+
+        return ENOSYS;
+}
+
+#endif /* HAVE_URING */
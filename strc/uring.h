@@ -0,0 +1,35 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * uring - count many small files through io_uring
+ *
+ * Opens, reads and closes of a whole batch of files are kept in flight
+ * on one ring, so the per-file syscall cost disappears behind the
+ * counting. Everything is done with raw syscalls, no liburing needed.
+ */
+#ifndef URING_H_
+#define URING_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "counter.h"
+
+struct uring_job
+{
+        const char *path;
+        off_t size;                     /* expected size, reading stops there or at EOF */
+        struct counter *ctr;
+        int err;
+};
+
+/* Return non-zero when the kernel can run the opcodes used here. */
+int uring_available(void);
+
+/* Count every job, per file failures are left in job->err. Return 0
+ * when the batch was processed, otherwise an errno value when no ring
+ * could be set up; no job has been touched then. */
+int uring_count(struct uring_job *jobs, size_t n);
+
+#endif /* URING_H_ */
@@ -0,0 +1,134 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#include "utf8.h"
+
+#include "simd.h"
+
+/* bytes the decoder checks before handing back to the kernel */
+#define UTF8_STRETCH 64
+
+static int seen_invalid;
+
+void utf8_reset(struct utf8_state *us)
+{
+        us->need = 0;
+}
+
+static void mark_bad(struct utf8_state *us, uint64_t off, uint64_t line)
+{
+        us->bad = 1;
+        us->bad_off = off;
+        us->bad_line = line;
+        us->need = 0;
+        __atomic_store_n(&seen_invalid, 1, __ATOMIC_RELAXED);
+}
+
+/* The sequence at stream offset 'off' of 'buf' is bad. It starts in this
+ * buffer or right before it, in which case no newline lies in between. */
+static void fail(struct utf8_state *us, const char *buf, uint64_t off)
+{
+        size_t local = off > us->pos ? (size_t) (off - us->pos) : 0;
+
+        mark_bad(us, off, us->lines + simd_count_byte(buf, local, '\n') + 1);
+}
+
+/* Decode from s[i] until 'UTF8_STRETCH' bytes were checked and no sequence
+ * is open, or 'n' is reached. Return where it stopped. */
+static size_t decode(struct utf8_state *us, const char *buf, size_t i, size_t n)
+{
+        const unsigned char *s = (const unsigned char *) buf;
+        size_t lim = n - i > UTF8_STRETCH ? i + UTF8_STRETCH : n;
+
+        for (; i < n && (i < lim || us->need); i++) {
+                unsigned char c = s[i];
+
+                if (us->need) {
+                        if (c < us->lo || c > us->hi) {
+                                fail(us, buf, us->start);
+                                return n;
+                        }
+                        us->lo = 0x80;
+                        us->hi = 0xBF;
+                        us->need--;
+                        continue;
+                }
+
+                if (c < 0x80)
+                        continue;
+
+                us->start = us->pos + i;
+                us->lo = 0x80;
+                us->hi = 0xBF;
+
+                if (c >= 0xC2 && c <= 0xDF) {
+                        us->need = 1;
+                } else if (c >= 0xE0 && c <= 0xEF) {
+                        us->need = 2;
+                        if (c == 0xE0)
+                                us->lo = 0xA0;  /* overlong */
+                        else if (c == 0xED)
+                                us->hi = 0x9F;  /* surrogates */
+                } else if (c >= 0xF0 && c <= 0xF4) {
+                        us->need = 3;
+                        if (c == 0xF0)
+                                us->lo = 0x90;  /* overlong */
+                        else if (c == 0xF4)
+                                us->hi = 0x8F;  /* above U+10FFFF */
+                } else {
+                        fail(us, buf, us->start);
+                        return n;
+                }
+        }
+
+        return i;
+}
+
+void utf8_feed(struct utf8_state *us, const char *buf, size_t n)
+{
+        size_t i = 0;
+
+        if (us->bad)
+                return;
+
+        while (i < n) {
+                if (!us->need)
+                        i += simd_utf8_valid(buf + i, n - i);
+                i = decode(us, buf, i, n);
+                if (us->bad)
+                        return;
+        }
+
+        us->lines += simd_count_byte(buf, n, '\n');
+        us->pos += n;
+}
+
+void utf8_merge(struct utf8_state *dst, const struct utf8_state *src)
+{
+        if (dst->bad)
+                return;
+
+        if (src->bad) {
+                mark_bad(dst, dst->pos + src->bad_off, dst->lines + src->bad_line);
+                return;
+        }
+
+        dst->start = dst->pos + src->start;
+        dst->need = src->need;
+        dst->lo = src->lo;
+        dst->hi = src->hi;
+        dst->pos += src->pos;
+        dst->lines += src->lines;
+}
+
+void utf8_finish(struct utf8_state *us)
+{
+        if (us->need)
+                mark_bad(us, us->start, us->lines + 1);
+}
+
+int utf8_seen_invalid(void)
+{
+        return __atomic_load_n(&seen_invalid, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,40 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * utf8 - validate UTF-8 and locate the first bad sequence
+ *
+ * The vector kernel clears the valid stretches, a byte by byte decoder
+ * finishes what it leaves: buffer tails, sequences cut across buffers and
+ * the exact place of an error. Overlong forms, surrogates and code points
+ * above U+10FFFF are invalid, as in RFC 3629.
+ */
+#ifndef UTF8_H_
+#define UTF8_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct utf8_state
+{
+        uint64_t pos;                   /* stream offset of the next byte fed */
+        uint64_t lines;                 /* newlines before it */
+        uint64_t start;                 /* offset of the open sequence */
+        int need;                       /* its missing continuation bytes */
+        unsigned char lo, hi;           /* range of the next one */
+        int bad;
+        uint64_t bad_off;               /* first bad sequence, 0-based */
+        uint64_t bad_line;              /* ... and its line, 1-based */
+};
+
+void utf8_reset(struct utf8_state *us);
+void utf8_feed(struct utf8_state *us, const char *buf, size_t n);
+/* 'src' continues the stream of 'dst'. */
+void utf8_merge(struct utf8_state *dst, const struct utf8_state *src);
+/* The stream has ended, a sequence still open is truncated. */
+void utf8_finish(struct utf8_state *us);
+
+/* Return non-zero once any stream was found invalid. */
+int utf8_seen_invalid(void);
+
+#endif /* UTF8_H_ */
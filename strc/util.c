@@ -0,0 +1,143 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#include "util.h"
+
+#include <stdlib.h>
+#include <r9k/panic.h>
+
+#define ARENA_CHUNK ((size_t) 1 << 20) /* 1mb */
+
+struct arena_chunk
+{
+        struct arena_chunk *next;
+        size_t used;
+        size_t size;
+        char data[];
+};
+
+void part_append(struct part *p, const char *buf, size_t n)
+{
+        if (n == 0)
+                return;
+
+        if (p->len + n > p->cap) {
+                size_t cap = p->cap ? p->cap : 256;
+                while (cap < p->len + n)
+                        cap *= 2;
+                char *grown = realloc(p->buf, cap);
+                PANIC_IF(!grown, "ERROR: out of memory\n");
+                p->buf = grown;
+                p->cap = cap;
+        }
+
+        memcpy(p->buf + p->len, buf, n);
+        p->len += n;
+}
+
+char *arena_copy(struct arena *a, const char *key, size_t len)
+{
+        struct arena_chunk *c = a->head;
+
+        if (!c || c->size - c->used < len) {
+                size_t size = len > ARENA_CHUNK ? len : ARENA_CHUNK;
+                c = malloc(sizeof(*c) + size);
+                PANIC_IF(!c, "ERROR: out of memory\n");
+                c->used = 0;
+                c->size = size;
+                c->next = a->head;
+                a->head = c;
+        }
+
+        char *p = c->data + c->used;
+        memcpy(p, key, len);
+        c->used += len;
+
+        return p;
+}
+
+void arena_free(struct arena *a)
+{
+        while (a->head) {
+                struct arena_chunk *next = a->head->next;
+                free(a->head);
+                a->head = next;
+        }
+}
+
+static void keyset_grow(struct keyset *ks)
+{
+        size_t cap = ks->cap ? ks->cap * 2 : 1024;
+        struct key_entry *slots = calloc(cap, sizeof(*slots));
+
+        PANIC_IF(!slots, "ERROR: out of memory\n");
+
+        for (size_t i = 0; i < ks->cap; i++) {
+                if (!ks->slots[i].count)
+                        continue;
+                size_t k = ks->slots[i].hash & (cap - 1);
+                while (slots[k].count)
+                        k = (k + 1) & (cap - 1);
+                slots[k] = ks->slots[i];
+        }
+
+        free(ks->slots);
+        ks->slots = slots;
+        ks->cap = cap;
+}
+
+void keyset_add(struct keyset *ks, const char *key, size_t len, uint64_t h, uint64_t count)
+{
+        if (2 * (ks->n + 1) > ks->cap)
+                keyset_grow(ks);
+
+        size_t i = h & (ks->cap - 1);
+        for (; ks->slots[i].count; i = (i + 1) & (ks->cap - 1)) {
+                if (same_key(&ks->slots[i], h, key, len)) {
+                        ks->slots[i].count += count;
+                        return;
+                }
+        }
+
+        ks->slots[i] = (struct key_entry) { h, count, arena_copy(&ks->arena, key, len), len };
+        ks->n++;
+}
+
+void keyset_free(struct keyset *ks)
+{
+        free(ks->slots);
+        ks->slots = NULL;
+        ks->cap = 0;
+        ks->n = 0;
+        arena_free(&ks->arena);
+}
+
+void registry_init(struct registry *r)
+{
+        PANIC_IF(pthread_key_create(&r->key, NULL) != 0, "ERROR: pthread_key_create\n");
+}
+
+void *registry_get(struct registry *r)
+{
+        return pthread_getspecific(r->key);
+}
+
+void registry_add(struct registry *r, struct registry_node *node)
+{
+        pthread_setspecific(r->key, node);
+
+        pthread_mutex_lock(&r->lock);
+        node->next = r->all;
+        r->all = node;
+        pthread_mutex_unlock(&r->lock);
+}
+
+struct registry_node *registry_take(struct registry *r)
+{
+        struct registry_node *all = r->all;
+
+        r->all = NULL;
+
+        return all;
+}
@@ -0,0 +1,98 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * util - pieces shared by the counting modules
+ *
+ * The whitespace test of the word splitters, and what topk and distinct
+ * both need to count keys: the open key of a stream, an arena and an
+ * exact set of keys, and a registry of per-thread objects that outlive
+ * their threads for the final merge.
+ */
+#ifndef UTIL_H_
+#define UTIL_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/* same set as isspace() in the C locale */
+static inline int is_ws(unsigned char c)
+{
+        return c == ' ' || (unsigned char) (c - '\t') <= '\r' - '\t';
+}
+
+/* A key still open at the end of the last buffer. */
+struct part
+{
+        char *buf;
+        size_t len;
+        size_t cap;
+};
+
+void part_append(struct part *p, const char *buf, size_t n);
+
+/* Key bytes in chunks, freed all at once. */
+struct arena
+{
+        struct arena_chunk *head;
+};
+
+char *arena_copy(struct arena *a, const char *key, size_t len);
+void arena_free(struct arena *a);
+
+struct key_entry
+{
+        uint64_t hash;
+        uint64_t count;                 /* 0 for a free slot */
+        char *key;
+        size_t len;
+};
+
+/* Keys with their counts, open addressing at most half full, key bytes
+ * in the arena. */
+struct keyset
+{
+        struct key_entry *slots;
+        size_t cap;                     /* power of two */
+        size_t n;
+        struct arena arena;
+};
+
+static inline int same_key(const struct key_entry *e, uint64_t h, const char *key, size_t len)
+{
+        return e->hash == h && e->len == len && memcmp(e->key, key, len) == 0;
+}
+
+/* Add 'count' to key 'key' of hash 'h', a new key is copied. */
+void keyset_add(struct keyset *ks, const char *key, size_t len, uint64_t h, uint64_t count);
+/* Free the slots and the arena and empty the set. */
+void keyset_free(struct keyset *ks);
+
+/* Objects embed this first to be kept in a registry. */
+struct registry_node
+{
+        struct registry_node *next;
+};
+
+/* One object per thread, which stays linked after the thread is gone. */
+struct registry
+{
+        pthread_mutex_t lock;
+        pthread_key_t key;
+        struct registry_node *all;
+};
+
+#define REGISTRY_INIT { PTHREAD_MUTEX_INITIALIZER, 0, NULL }
+
+/* Must be called before any thread uses 'r'. */
+void registry_init(struct registry *r);
+/* The object of the calling thread, NULL before registry_add(). */
+void *registry_get(struct registry *r);
+/* Make 'node' the object of the calling thread. */
+void registry_add(struct registry *r, struct registry_node *node);
+/* Unlink every object, no thread may use them anymore. */
+struct registry_node *registry_take(struct registry *r);
+
+#endif /* UTIL_H_ */
@@ -0,0 +1,198 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ */
+#define _GNU_SOURCE /* DT_*, fstatat, O_DIRECTORY, syscall */
+#include "walk.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+struct dir_job
+{
+        const struct walk *w;
+        char *path;
+        int nofollow;                   /* O_NOFOLLOW below the root */
+};
+
+static int match_any(const char **globs, uint32_t n, const char *name)
+{
+        for (uint32_t i = 0; i < n; i++) {
+                if (fnmatch(globs[i], name, 0) == 0)
+                        return 1;
+        }
+
+        return 0;
+}
+
+static char *join(const char *dir, const char *name)
+{
+        size_t dlen = strlen(dir);
+        size_t nlen = strlen(name);
+        int slash = dlen > 0 && dir[dlen - 1] != '/';
+        char *path = malloc(dlen + (size_t) slash + nlen + 1);
+
+        if (!path)
+                return NULL;
+
+        memcpy(path, dir, dlen);
+        if (slash)
+                path[dlen] = '/';
+        memcpy(path + dlen + slash, name, nlen + 1);
+
+        return path;
+}
+
+static void walk_dir(void *arg);
+
+static int submit_dir(const struct walk *w, char *path, int nofollow)
+{
+        struct dir_job *job = malloc(sizeof(*job));
+        if (!job) {
+                free(path);
+                return ENOMEM;
+        }
+
+        job->w = w;
+        job->path = path;
+        job->nofollow = nofollow;
+
+        int err = pool_submit(w->pool, walk_dir, job);
+        if (err != 0) {
+                free(path);
+                free(job);
+        }
+
+        return err;
+}
+
+static void visit(struct dir_job *job, int dirfd, const char *name, unsigned char type)
+{
+        const struct walk *w = job->w;
+        const struct walk_opts *opts = w->opts;
+        struct stat st;
+
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                return;
+
+        if (match_any(opts->exclude, opts->nexclude, name))
+                return;
+
+        if (type == DT_UNKNOWN) {
+                if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                        return;
+                type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+
+        if (type != DT_DIR && type != DT_REG)
+                return;
+
+        if (type == DT_REG && opts->ninclude && !match_any(opts->include, opts->ninclude, name))
+                return;
+
+        char *path = join(job->path, name);
+        if (!path) {
+                fprintf(stderr, "WARNING: %s/%s: %s\n", job->path, name, strerror(ENOMEM));
+                return;
+        }
+
+        if (type == DT_DIR) {
+                int err = submit_dir(w, path, O_NOFOLLOW);
+                if (err != 0)
+                        fprintf(stderr, "WARNING: %s/%s: %s\n", job->path, name, strerror(err));
+        } else {
+                w->fn(w->ctx, path);
+        }
+}
+
+#ifdef __linux__
+struct linux_dirent64
+{
+        uint64_t       d_ino;
+        int64_t        d_off;
+        unsigned short d_reclen;
+        unsigned char  d_type;
+        char           d_name[];
+};
+
+static int scan_dir(struct dir_job *job, int fd)
+{
+        char buf[32768] __attribute__((aligned(8)));
+        long n;
+
+        while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+                for (long off = 0; off < n; ) {
+                        struct linux_dirent64 *d = (struct linux_dirent64 *) (buf + off);
+                        visit(job, fd, d->d_name, d->d_type);
+                        off += d->d_reclen;
+                }
+        }
+
+        return n < 0 ? errno : 0;
+}
+#else
+static int scan_dir(struct dir_job *job, int fd)
+{
+        struct dirent *d;
+        DIR *dir = fdopendir(dup(fd));
+
+        if (!dir)
+                return errno;
+
+        while ((d = readdir(dir)) != NULL)
+                visit(job, dirfd(dir), d->d_name, d->d_type);
+
+        closedir(dir);
+
+        return 0;
+}
+#endif
+
+static void walk_dir(void *arg)
+{
+        struct dir_job *job = arg;
+        int err;
+
+        int fd = open(job->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC | job->nofollow);
+        if (fd < 0) {
+                err = errno;
+        } else {
+                err = scan_dir(job, fd);
+                close(fd);
+        }
+
+        if (err != 0)
+                fprintf(stderr, "WARNING: %s: %s\n", job->path, strerror(err));
+
+        free(job->path);
+        free(job);
+}
+
+int walk_start(const struct walk *w, const char *root)
+{
+        struct stat st;
+
+        if (stat(root, &st) != 0)
+                return errno;
+
+        char *path = strdup(root);
+        if (!path)
+                return ENOMEM;
+
+        if (S_ISREG(st.st_mode)) {
+                w->fn(w->ctx, path);
+                return 0;
+        }
+
+        return submit_dir(w, path, 0);
+}
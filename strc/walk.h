@@ -0,0 +1,48 @@
+/*
+-* SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * walk - parallel recursive directory traversal
+ *
+ * Every directory is listed by a job on the worker pool, so the tree is
+ * walked by all workers at once and files found are handed out while the
+ * walk is still going. A directory is opened by its full path when its job
+ * runs, so queued jobs hold no descriptor, and entries of unknown type are
+ * looked up with fstatat() relative to it. On Linux it is read with
+ * getdents64(). Symbolic links below the root are not followed and only
+ * regular files are reported, but a directory swapped for a link above
+ * the one opened is not noticed.
+ */
+#ifndef WALK_H_
+#define WALK_H_
+
+#include <stdint.h>
+
+#include "pool.h"
+
+struct walk_opts
+{
+        const char **include;           /* file name globs, all files if none */
+        uint32_t ninclude;
+        const char **exclude;           /* file or directory name globs to skip */
+        uint32_t nexclude;
+};
+
+/* Called from a pool worker for every regular file found, 'path' is
+ * malloc()ed and owned by the callee. */
+typedef void (*walk_fn_t)(void *ctx, char *path);
+
+struct walk
+{
+        struct pool *pool;
+        const struct walk_opts *opts;
+        walk_fn_t fn;
+        void *ctx;
+};
+
+/* Walk 'root' on w->pool, a regular file root is reported as is. Returns
+ * once the walk is queued, use pool_wait() to wait for it and everything
+ * w->fn submitted; 'w' must stay valid until then. */
+int walk_start(const struct walk *w, const char *root);
+
+#endif /* WALK_H_ */
@@ -0,0 +1,67 @@
+#!/bin/sh
+#
+# SPDX-License-Identifier: MIT
+# Copyright (c) 2025 Varketh Nockrath
+#
+# cli_test - regressions of the strc command line
+#
+# Usage: cli_test.sh <strc>
+
+strc=$1
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+failures=0
+
+# expect <name> <expected output> <strc arguments...>
+expect()
+{
+        name=$1
+        want=$2
+        shift 2
+
+        got=$("$strc" "$@" 2>&1 | sed 's/^ *//; s/  */ /g')
+        if [ "$got" != "$want" ]; then
+                printf 'FAIL %s\n  want: %s\n  got:  %s\n' "$name" "$want" "$got" >&2
+                failures=$((failures + 1))
+        fi
+}
+
+printf 'a b\nc\n\nd e f\n' > "$tmp/lines"
+
+# lines come from the line length kernel alone
+expect "-L -w lines" "4 6 $tmp/lines
+min 0 max 5 mean 2.25
+0 - 0 1 25.00%
+1 - 1 1 25.00%
+2 - 3 1 25.00%
+4 - 7 1 25.00%" -L -w -f "$tmp/lines"
+
+printf 'a b\n\nc d\n\ne\n' > "$tmp/paras"
+printf 'a;b c;d\n' > "$tmp/semi"
+
+# records come from the delimiter search alone
+expect "-d multi-byte -w" "2 5 $tmp/paras" -d '\n\n' -w -f "$tmp/paras"
+expect "-d byte -w" "2 2 $tmp/semi" -d ';' -w -f "$tmp/semi"
+
+printf '{"a":1}\nbad\n' > "$tmp/j1"
+printf 'x\n{"b":2}\n' > "$tmp/j2"
+
+# malformed lines are listed per file, never against the total
+expect "--ndjson total" "1 1 $tmp/j1
+malformed record at line 2, not a JSON value
+1 1 $tmp/j2
+malformed record at line 1, not a JSON value
+2 2 total" --ndjson -f "$tmp/j1" -f "$tmp/j2"
+
+printf 'ok\n' > "$tmp/u1"
+printf 'a\n\377\n' > "$tmp/u2"
+
+# a byte offset only means something within its own file
+expect "-u total" "3 $tmp/u1
+valid UTF-8
+4 $tmp/u2
+invalid UTF-8 at byte 2, line 2
+7 total
+invalid UTF-8" -u -f "$tmp/u1" -f "$tmp/u2"
+
+[ "$failures" -eq 0 ] || { echo "$failures failures" >&2; exit 1; }
@@ -0,0 +1,284 @@
+/*
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * parse_test - compare the CSV, NDJSON and line index parsers of strc
+ * with a reference
+ *
+ * Random documents are counted whole at the scalar level, which is the
+ * reference for the CSV and NDJSON parsers, then fed in random pieces at
+ * each level named on the command line, all of them when none is. NDJSON
+ * is also split at a newline and merged back. Line index samples are
+ * checked against the line starts found byte by byte. A level the CPU
+ * lacks runs as the best one it has.
+ */
+#define _GNU_SOURCE /* setenv */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <r9k/array.h>
+
+#include "csv.h"
+#include "lineidx.h"
+#include "ndjson.h"
+#include "simd.h"
+
+#define DOC_LEN    ((size_t) 96 << 10) /* past the slices of the parsers */
+#define MAX_PIECE  5000
+#define ROUNDS     8
+#define MAX_REPORT 20
+
+static const char *all_levels[] = { "sse2", "avx2", "avx512" };
+
+static int failures;
+static uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t next_rand(void)
+{
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+
+        return seed;
+}
+
+static void use_level(const char *name)
+{
+        setenv("STRC_SIMD", name, 1);
+        simd_init();
+}
+
+static void fail(const char *level, const char *what, int round)
+{
+        if (failures++ < MAX_REPORT)
+                fprintf(stderr, "FAIL %s: %s, round %d\n", level, what, round);
+}
+
+/* Append the pieces picked at random from 'pieces' until 'len' bytes. */
+static void put_pieces(char *buf, size_t len, const char *const *pieces, size_t npieces)
+{
+        size_t i = 0;
+
+        while (i < len) {
+                const char *s = pieces[next_rand() % npieces];
+                size_t n = strlen(s);
+
+                if (n > len - i)
+                        n = len - i;
+                memcpy(buf + i, s, n);
+                i += n;
+        }
+}
+
+/* Fields plain and quoted, with escaped and stray quotes, CRLF and blank
+ * lines, and now and then a long quoted field spanning lines. */
+static void make_csv(char *buf, size_t len)
+{
+        static const char *pieces[] = {
+                "a", "bc", "12.5", ",", ",", ",", "\n", "\n", "\r\n", "\"q\"", "\"x,y\"",
+                "\"say \"\"hi\"\"\"", "\"two\nlines\"", "\"", "a\"b", "\"\"", "\n\n",
+                "\"long,,,\n\n,,,\"\"quoted,,,\"\"\n,,,field,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,,\"",
+        };
+
+        put_pieces(buf, len, pieces, ARRAY_SIZE(pieces));
+}
+
+/* Mostly well-formed records, some cut or garbled, some nested deep. */
+static void make_ndjson(char *buf, size_t len)
+{
+        static const char *pieces[] = {
+                "{\"a\":1}\n", "[1,2,3]\n", "\"str\"\n", "42\n", "true\n", "null\n", "\n",
+                "{\"k\":\"v\\\"q\\\\\",\"l\":[{},[],{\"m\":null}]}\n", "{\"s\":\"{[\"}\n",
+                "  {\"pad\": [ 1 , 2 ] }  \r\n", "{\"cut\":\n", "]\n", "{\"a\":[}\n", "\"open\n",
+                "tru\n", "[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[]]]]]]]]]]"
+                "]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]\n",
+                "{\"x\":\"\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\"}\n",
+                "{\"b\":1}{\"c\":2}\n", "\"\xc3\xa9\xe6\x97\xa5\"\n", "\\", "\"", "{", "}",
+        };
+
+        put_pieces(buf, len, pieces, ARRAY_SIZE(pieces));
+}
+
+/* Feed buf[0, len) to 'feed' in random pieces of up to MAX_PIECE bytes. */
+#define FEED_PIECES(feed, st, buf, len)                                         \
+        do {                                                                    \
+                size_t _i = 0;                                                  \
+                while (_i < (len)) {                                            \
+                        size_t _n = next_rand() % MAX_PIECE + 1;                \
+                        if (_n > (len) - _i)                                    \
+                                _n = (len) - _i;                                \
+                        feed((st), (buf) + _i, _n);                             \
+                        _i += _n;                                               \
+                }                                                               \
+        } while (0)
+
+static void count_csv(struct csv_state *cs, const char *buf, size_t len, int pieces)
+{
+        memset(cs, 0, sizeof(*cs));
+        if (pieces)
+                FEED_PIECES(csv_feed, cs, buf, len);
+        else
+                csv_feed(cs, buf, len);
+        csv_finish(cs);
+}
+
+static void check_csv(const char *level, int round, const char *buf, size_t len)
+{
+        struct csv_state want, got;
+
+        use_level("scalar");
+        count_csv(&want, buf, len, 0);
+        use_level(level);
+        count_csv(&got, buf, len, 1);
+
+        if (want.records != got.records || want.fields != got.fields || want.malformed != got.malformed)
+                fail(level, "csv", round);
+}
+
+static void count_ndjson(struct ndjson_state *js, const char *buf, size_t len, int pieces)
+{
+        memset(js, 0, sizeof(*js));
+        if (pieces)
+                FEED_PIECES(ndjson_feed, js, buf, len);
+        else
+                ndjson_feed(js, buf, len);
+        ndjson_finish(js);
+}
+
+static int same_ndjson(const struct ndjson_state *a, const struct ndjson_state *b)
+{
+        if (a->records != b->records || a->malformed != b->malformed || a->lines != b->lines
+            || a->nbad != b->nbad)
+                return 0;
+
+        for (size_t i = 0; i < a->nbad; i++) {
+                if (a->bad[i].line != b->bad[i].line || a->bad[i].why != b->bad[i].why)
+                        return 0;
+        }
+
+        return 1;
+}
+
+static void check_ndjson(const char *level, int round, const char *buf, size_t len)
+{
+        static struct ndjson_state want, got, tail;
+
+        use_level("scalar");
+        count_ndjson(&want, buf, len, 0);
+        use_level(level);
+        count_ndjson(&got, buf, len, 1);
+
+        if (!same_ndjson(&want, &got))
+                fail(level, "ndjson", round);
+
+        /* two ranges cut after a newline, as the workers count them */
+        size_t from = next_rand() % len;
+        const char *nl = memchr(buf + from, '\n', len - from);
+        if (!nl)
+                return;
+
+        size_t cut = (size_t) (nl - buf) + 1;
+
+        memset(&got, 0, sizeof(got));
+        FEED_PIECES(ndjson_feed, &got, buf, cut);
+        ndjson_finish(&got);
+        count_ndjson(&tail, buf + cut, len - cut, 1);
+        ndjson_merge(&got, &tail);
+
+        if (!same_ndjson(&want, &got))
+                fail(level, "ndjson_merge", round);
+}
+
+static void feed_lineidx(struct lineidx_state *ix, const char *buf, size_t n)
+{
+        lineidx_feed(ix, buf, n, simd_count_byte(buf, n, '\n'));
+}
+
+/* Whether the samples of 'ix' are all line starts of buf[0, len), each
+ * with the newlines before it and the first 'whole' ones at every 'step'
+ * lines. */
+static int lineidx_ok(const struct lineidx_state *ix, const char *buf, size_t len, uint64_t step,
+                      size_t whole)
+{
+        uint64_t lines = 0;
+        size_t i = 0;
+
+        for (size_t k = 0; k < ix->n; k++) {
+                const struct lineidx_entry *e = &ix->e[k];
+
+                if (e->off <= i || e->off > len || buf[e->off - 1] != '\n')
+                        return 0;
+                for (; i < e->off; i++)
+                        lines += buf[i] == '\n';
+                if (e->line != lines || (k < whole && e->line != (k + 1) * step))
+                        return 0;
+        }
+
+        for (; i < len; i++)
+                lines += buf[i] == '\n';
+
+        return ix->lines == lines && ix->pos == len;
+}
+
+static void check_lineidx(const char *level, int round, const char *buf, size_t len)
+{
+        static const uint64_t steps[] = { 1, 3, 64, 1000 };
+
+        use_level(level);
+
+        for (size_t s = 0; s < ARRAY_SIZE(steps); s++) {
+                struct lineidx_state *ix = lineidx_state_new();
+                struct lineidx_state *tail = lineidx_state_new();
+                size_t cut = next_rand() % len;
+                size_t lines = 0;
+
+                lineidx_setup(steps[s]);
+
+                FEED_PIECES(feed_lineidx, ix, buf, len);
+                for (size_t i = 0; i < len; i++)
+                        lines += buf[i] == '\n';
+                if (ix->n != lines / steps[s] || !lineidx_ok(ix, buf, len, steps[s], ix->n))
+                        fail(level, "lineidx", round);
+
+                /* the tail samples its own step-th lines, rebased */
+                ix->n = ix->lines = ix->pos = 0;
+                FEED_PIECES(feed_lineidx, ix, buf, cut);
+                FEED_PIECES(feed_lineidx, tail, buf + cut, len - cut);
+                size_t head = ix->n;
+                lineidx_merge(ix, tail);
+                if (ix->n != head + tail->n || !lineidx_ok(ix, buf, len, steps[s], head))
+                        fail(level, "lineidx_merge", round);
+
+                lineidx_state_free(tail);
+                lineidx_state_free(ix);
+        }
+}
+
+int main(int argc, char **argv)
+{
+        static char csv[DOC_LEN], ndjson[DOC_LEN];
+        const char **levels = argc > 1 ? (const char **) argv + 1 : all_levels;
+        int nlevels = argc > 1 ? argc - 1 : (int) ARRAY_SIZE(all_levels);
+
+        for (int round = 0; round < ROUNDS; round++) {
+                /* a short document now and then, tails only */
+                size_t len = round % 4 == 3 ? next_rand() % 200 + 1 : DOC_LEN;
+
+                make_csv(csv, len);
+                make_ndjson(ndjson, len);
+
+                for (int l = 0; l < nlevels; l++) {
+                        check_csv(levels[l], round, csv, len);
+                        check_ndjson(levels[l], round, ndjson, len);
+                        check_lineidx(levels[l], round, csv, len);
+                        check_lineidx(levels[l], round, ndjson, len);
+                }
+        }
+
+        if (failures) {
+                fprintf(stderr, "%d failures\n", failures);
+                return 1;
+        }
+
+        return 0;
+}
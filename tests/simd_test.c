@@ -0,0 +1,348 @@
+/*
+ * SPDX-License-Identifier: MIT
+ * Copyright (c) 2025 Varketh Nockrath
+ *
+ * simd_test - compare the vector kernels of strc with the scalar ones
+ *
+ * Each level named on the command line, all of them when none is, is
+ * forced through STRC_SIMD and every kernel is run on buffers at each
+ * alignment in a 64-byte block with every tail length up to MAX_TAIL,
+ * alone and behind LONG_BASE bytes for the main loops, and at lengths
+ * around the points where the counting kernels flush their byte lanes.
+ * The results must be those of the scalar kernels, selected the same
+ * way. A level the CPU lacks runs as the best one it has.
+ */
+#define _GNU_SOURCE /* setenv */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <r9k/array.h>
+
+#include "simd.h"
+
+#define MAX_TAIL   128
+#define LONG_BASE  256
+/* byte lanes count at most 255 loads, of 16 bytes for SSE2, 64 for AVX2 */
+#define SSE2_FLUSH (255 * 16)
+#define AVX2_FLUSH (255 * 64)
+#define MAX_LEN    (2 * AVX2_FLUSH + 64 + 1)
+#define BUF_LEN    (64 + MAX_LEN + 64)
+#define MAX_WORDS  (4 * ((MAX_LEN + 63) / 64))
+#define MAX_REPORT 20
+
+enum { FILL_BYTES, FILL_TEXT, FILL_SPARSE, FILL_CONT, FILL_RUNS, FILL_COUNT };
+
+static const char *all_levels[] = { "sse2", "avx2", "avx512" };
+static const char *fill_names[] = { "bytes", "text", "sparse", "cont", "runs" };
+
+/* at, one short of and one past a flush, and a flush behind a vector
+ * tail left to the next smaller kernel */
+static const size_t flush_lens[] = {
+        SSE2_FLUSH - 1, SSE2_FLUSH, SSE2_FLUSH + 1, 2 * SSE2_FLUSH + 1,
+        AVX2_FLUSH - 1, AVX2_FLUSH, AVX2_FLUSH + 1, AVX2_FLUSH + 16 + 1,
+        2 * AVX2_FLUSH, 2 * AVX2_FLUSH + 1, MAX_LEN,
+};
+
+struct ctx
+{
+        const char *level;
+        int fill;
+        size_t off;
+};
+
+static int failures;
+static uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t next_rand(void)
+{
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+
+        return seed;
+}
+
+static void use_level(const char *name)
+{
+        setenv("STRC_SIMD", name, 1);
+        simd_init();
+}
+
+static void fail(const struct ctx *cx, const char *what, size_t n)
+{
+        if (failures++ < MAX_REPORT)
+                fprintf(stderr, "FAIL %s: %s, %s fill, offset %zu, length %zu\n",
+                        cx->level, what, fill_names[cx->fill], cx->off, n);
+}
+
+/* Text with whitespace, JSON punctuation and 2, 3 and 4 byte characters,
+ * now and then broken by a stray or cut sequence. */
+static size_t put_text(unsigned char *p)
+{
+        static const char *pieces[] = {
+                "a", "e", "word", " ", " ", "\t", "\n", "\n", "\r\n", "\v", "\f",
+                "\"", "\\", "{", "}", "[", "]", ",", ":", "\xc3\xa9", "\xe6\x97\xa5",
+                "\xf0\x9f\x98\x80", "\xe2\x80\xa8",
+        };
+        static const char *broken[] = { "\x80", "\xff", "\xc0\xaf", "\xe6\x97", "\xed\xa0\x80", "\xf4\x90\x80\x80" };
+        const char *s;
+
+        if (next_rand() % 64 == 0)
+                s = broken[next_rand() % ARRAY_SIZE(broken)];
+        else
+                s = pieces[next_rand() % ARRAY_SIZE(pieces)];
+
+        memcpy(p, s, strlen(s));
+
+        return strlen(s);
+}
+
+static void fill(unsigned char *buf, int kind)
+{
+        static const unsigned char run_bytes[] = { '\n', ' ', 0x80, 'a' };
+        size_t i = 0;
+
+        while (i < BUF_LEN) {
+                uint64_t r = next_rand();
+
+                switch (kind) {
+                case FILL_BYTES:
+                        buf[i++] = (unsigned char) r;
+                        break;
+                case FILL_TEXT:
+                        if (i + 4 > BUF_LEN)
+                                buf[i++] = 'a';
+                        else
+                                i += put_text(buf + i);
+                        break;
+                case FILL_SPARSE:
+                        buf[i++] = r % 97 == 0 ? '\n' : r % 89 == 0 ? ' ' : 'a';
+                        break;
+                case FILL_RUNS:
+                        /* runs long enough to fill every lane up to a flush */
+                        for (size_t k = r % (2 * AVX2_FLUSH) + 1; k && i < BUF_LEN; k--)
+                                buf[i++] = run_bytes[(r >> 32) % ARRAY_SIZE(run_bytes)];
+                        break;
+                default:
+                        buf[i++] = r % 61 == 0 ? '\n' : 0x80 | (unsigned char) (r % 64);
+                        break;
+                }
+        }
+}
+
+/* Whether buf[0, n) is valid UTF-8 ending on a character boundary. */
+static int utf8_ok(const unsigned char *s, size_t n)
+{
+        size_t i = 0;
+
+        while (i < n) {
+                unsigned c = s[i];
+                uint32_t cp, min;
+                size_t len;
+
+                if (c < 0x80) {
+                        i++;
+                        continue;
+                }
+
+                if (c >= 0xc2 && c <= 0xdf) {
+                        len = 2;
+                        cp = c & 0x1f;
+                        min = 0x80;
+                } else if ((c & 0xf0) == 0xe0) {
+                        len = 3;
+                        cp = c & 0x0f;
+                        min = 0x800;
+                } else if (c >= 0xf0 && c <= 0xf4) {
+                        len = 4;
+                        cp = c & 0x07;
+                        min = 0x10000;
+                } else {
+                        return 0;
+                }
+
+                if (n - i < len)
+                        return 0;
+                for (size_t k = 1; k < len; k++) {
+                        if ((s[i + k] & 0xc0) != 0x80)
+                                return 0;
+                        cp = cp << 6 | (s[i + k] & 0x3f);
+                }
+                if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+                        return 0;
+
+                i += len;
+        }
+
+        return 1;
+}
+
+static void check_counts(const struct ctx *cx, const char *buf, size_t n)
+{
+        const unsigned char bytes[] = { '\n', ' ', 0x80, n ? (unsigned char) buf[0] : 0 };
+        size_t want[4], got[4];
+        size_t want_utf8, got_utf8;
+
+        use_level("scalar");
+        for (int k = 0; k < 4; k++)
+                want[k] = simd_count_byte(buf, n, bytes[k]);
+        want_utf8 = simd_count_utf8(buf, n);
+
+        use_level(cx->level);
+        for (int k = 0; k < 4; k++)
+                got[k] = simd_count_byte(buf, n, bytes[k]);
+        got_utf8 = simd_count_utf8(buf, n);
+
+        if (memcmp(want, got, sizeof(want)) != 0)
+                fail(cx, "simd_count_byte", n);
+        if (want_utf8 != got_utf8)
+                fail(cx, "simd_count_utf8", n);
+}
+
+static void check_tally(const struct ctx *cx, const char *buf, size_t n)
+{
+        for (int in_word = 0; in_word < 2; in_word++) {
+                struct simd_tally want = { 1, 2, 3, in_word };
+                struct simd_tally got = want;
+
+                use_level("scalar");
+                simd_tally(buf, n, &want);
+                use_level(cx->level);
+                simd_tally(buf, n, &got);
+
+                if (want.lines != got.lines || want.chars != got.chars || want.words != got.words
+                    || want.in_word != got.in_word)
+                        fail(cx, "simd_tally", n);
+        }
+}
+
+static void check_lines(const struct ctx *cx, const char *buf, size_t n)
+{
+        for (uint64_t cur = 0; cur < 10; cur += 9) {
+                struct simd_lines want;
+                struct simd_lines got;
+
+                memset(&want, 0, sizeof(want));
+                want.min = UINT64_MAX;
+                want.cur = cur;
+                got = want;
+
+                use_level("scalar");
+                simd_lines(buf, n, &want);
+                use_level(cx->level);
+                simd_lines(buf, n, &got);
+
+                if (memcmp(&want, &got, sizeof(want)) != 0)
+                        fail(cx, "simd_lines", n);
+        }
+}
+
+static void check_find_pair(const struct ctx *cx, const char *buf, size_t n)
+{
+        static const size_t gaps[] = { 1, 2, 5, 17, 64 };
+        static const unsigned char pairs[][2] = { { ' ', ' ' }, { 'a', '\n' }, { 0xc3, 0xa9 } };
+        uint64_t want[MAX_WORDS], got[MAX_WORDS];
+
+        for (size_t g = 0; g < ARRAY_SIZE(gaps); g++) {
+                size_t gap = gaps[g];
+
+                if (n <= gap)
+                        continue;
+
+                size_t words = (n - gap + 63) / 64;
+
+                for (size_t k = 0; k < ARRAY_SIZE(pairs); k++) {
+                        memset(want, 0xa5, words * sizeof(uint64_t));
+                        memset(got, 0x5a, words * sizeof(uint64_t));
+
+                        use_level("scalar");
+                        simd_find_pair(buf, n, gap, pairs[k][0], pairs[k][1], want);
+                        use_level(cx->level);
+                        simd_find_pair(buf, n, gap, pairs[k][0], pairs[k][1], got);
+
+                        if (memcmp(want, got, words * sizeof(uint64_t)) != 0)
+                                fail(cx, "simd_find_pair", n);
+                }
+        }
+}
+
+static void check_find_bytes4(const struct ctx *cx, const char *buf, size_t n)
+{
+        static const unsigned char sets[][4] = {
+                { '"', '\\', '\n', '\r' }, { '{', '}', '[', ']' }, { ',', ',', 0x80, 0xff },
+        };
+        uint64_t want[MAX_WORDS], got[MAX_WORDS];
+        size_t words = 4 * ((n + 63) / 64);
+
+        for (size_t k = 0; k < ARRAY_SIZE(sets); k++) {
+                memset(want, 0xa5, words * sizeof(uint64_t));
+                memset(got, 0x5a, words * sizeof(uint64_t));
+
+                use_level("scalar");
+                simd_find_bytes4(buf, n, sets[k], want);
+                use_level(cx->level);
+                simd_find_bytes4(buf, n, sets[k], got);
+
+                if (memcmp(want, got, words * sizeof(uint64_t)) != 0)
+                        fail(cx, "simd_find_bytes4", n);
+        }
+}
+
+/* Kernels may stop anywhere before the first invalid byte, but what they
+ * pass must be valid and end on a character boundary. */
+static void check_utf8_valid(const struct ctx *cx, const char *buf, size_t n)
+{
+        /* buf[0] must start a character */
+        if (n && ((unsigned char) buf[0] & 0xc0) == 0x80)
+                return;
+
+        use_level(cx->level);
+        size_t p = simd_utf8_valid(buf, n);
+
+        if (p > n || !utf8_ok((const unsigned char *) buf, p))
+                fail(cx, "simd_utf8_valid", n);
+}
+
+static void check(const struct ctx *cx, const char *buf, size_t n)
+{
+        check_counts(cx, buf, n);
+        check_tally(cx, buf, n);
+        check_lines(cx, buf, n);
+        check_find_pair(cx, buf, n);
+        check_find_bytes4(cx, buf, n);
+        check_utf8_valid(cx, buf, n);
+}
+
+int main(int argc, char **argv)
+{
+        static unsigned char buf[BUF_LEN] __attribute__((aligned(64)));
+        const char **levels = argc > 1 ? (const char **) argv + 1 : all_levels;
+        int nlevels = argc > 1 ? argc - 1 : (int) ARRAY_SIZE(all_levels);
+
+        for (int l = 0; l < nlevels; l++) {
+                for (int f = 0; f < FILL_COUNT; f++) {
+                        fill(buf, f);
+
+                        for (size_t off = 0; off < 64; off++) {
+                                struct ctx cx = { levels[l], f, off };
+                                const char *p = (const char *) buf + off;
+
+                                for (size_t tail = 0; tail <= MAX_TAIL; tail++) {
+                                        check(&cx, p, tail);
+                                        check(&cx, p, LONG_BASE + tail);
+                                }
+
+                                /* slow, and the flushes don't care for alignment */
+                                for (size_t k = 0; k < ARRAY_SIZE(flush_lens) && off % 8 == 0; k++)
+                                        check(&cx, p, flush_lens[k]);
+                        }
+                }
+        }
+
+        if (failures) {
+                fprintf(stderr, "%d failures\n", failures);
+                return 1;
+        }
+
+        return 0;
+}